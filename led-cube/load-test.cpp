@@ -0,0 +1,431 @@
+/**
+ * REST API load test for the LED cube controller
+ * * ====================================================================
+ * PURPOSE
+ * ====================================================================
+ * Replays synthetic or recorded /update, /status and /config traffic
+ * against a running controller at a ladder of request rates, and puts the
+ * client-side latency of every step next to the server's own frame-time
+ * metrics for the same window (scraped from GET /metrics before and after
+ * the step). The last rate at which the cube keeps its full governor rate
+ * and drops no more than `max-drop` percent of its frames is reported as
+ * the sustained update rate.
+ *
+ * Traffic is open loop: each worker sends on a fixed schedule, and latency
+ * is measured from the scheduled send time, so a server that falls behind
+ * shows up as growing latency instead of a politely slower client. With
+ * rates=0 every worker sends back to back instead.
+ *
+ * ====================================================================
+ * PAYLOADS (payloads=name:weight,...)
+ * ====================================================================
+ * - heat:     { "mode": "heat", "colour", "width", "percent" }
+ * - custom:   { "mode": "custom", "geometry", "width", "percent", colours }
+ * - segments: legacy heat payload with a "segments" array of 0..100 levels
+ * - elements: custom payload with two layered "elements"
+ * With replay=FILE the /update bodies are the lines of FILE instead (the
+ * same format as the benchmark build's bench-replay), cycled per worker.
+ *
+ * ====================================================================
+ * OUTPUT
+ * ====================================================================
+ * One line per rate step on stdout:
+ *   rate, sent, rps           offered rate, requests sent, achieved rate
+ *   err                       transport errors and non-2xx/304 answers
+ *   p50/p99/max_ms            client latency over all request kinds
+ *   upd_p99                   client p99 of /update alone
+ *   fps, drop%                frames rendered per second and the share
+ *                             that missed their pacing deadline
+ *   busy_ms, busy_p99         mean frame work over the step (from the
+ *                             summary sums) and the server's p99 at its end
+ *   gov                       governor frame rate at the end of the step
+ *   applied, merged           updates taken by the render loop, or coalesced
+ *                             into a target that was still waiting
+ * Progress and errors go to stderr.
+ *
+ * Options (--key=value): host, port, token, concurrency, rates, duration,
+ *          settle, mix, payloads, replay, etag, max-drop, seed.
+ */
+
+#include "httplib.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <map>
+#include <random>
+#include <sstream>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+
+// =======================================================
+// OPTIONS
+// =======================================================
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    std::string token = "1234567890";
+    int concurrency = 4;                        // worker threads, one keep-alive connection each
+    std::vector<int> rates = {25, 50, 100, 200, 400};   // requests per second per step (0: as fast as possible)
+    int duration = 15;                          // seconds per step (>= 13 s covers the server's 512-frame window)
+    int settle = 3;                             // idle seconds between steps
+    std::vector<int> mix = {8, 1, 1};           // weights of /update, /status, /config
+    std::vector<int> payloads = {1, 1, 1, 1};   // weights of heat, custom, segments, elements
+    std::string replay;                         // file of /update bodies, one per line
+    int etag = 1;                               // send the last /status ETag as If-None-Match
+    float maxDrop = 1.0f;                       // dropped-frame percentage that still counts as sustained
+    unsigned seed = 1;
+};
+
+enum Kind { KIND_UPDATE, KIND_STATUS, KIND_CONFIG, KIND_COUNT };
+static const char *const KIND_NAMES[KIND_COUNT] = { "update", "status", "config" };
+
+enum Payload { PAYLOAD_HEAT, PAYLOAD_CUSTOM, PAYLOAD_SEGMENTS, PAYLOAD_ELEMENTS, PAYLOAD_COUNT };
+static const char *const PAYLOAD_NAMES[PAYLOAD_COUNT] = { "heat", "custom", "segments", "elements" };
+
+static volatile bool interrupt_received = false;
+static void InterruptHandler(int) { interrupt_received = true; }
+
+// "name:weight,..." into weights indexed like names[]; unnamed entries keep 0
+static bool parse_weights(const std::string &v, const char *const *names, int count, std::vector<int> &out) {
+    std::vector<int> w(count, 0);
+    std::stringstream ss(v);
+    for (std::string item; std::getline(ss, item, ','); ) {
+        size_t colon = item.find(':');
+        std::string name = item.substr(0, colon);
+        int weight = colon == std::string::npos ? 1 : atoi(item.c_str() + colon + 1);
+        int i = 0;
+        while (i < count && name != names[i]) i++;
+        if (i == count || weight < 0) return false;
+        w[i] = weight;
+    }
+    int total = 0;
+    for (int x : w) total += x;
+    if (total == 0) return false;
+    out = w;
+    return true;
+}
+
+static bool parse_options(int argc, char *argv[], Options &o) {
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        size_t eq = a.find('=');
+        if (a.compare(0, 2, "--") != 0 || eq == std::string::npos) { fprintf(stderr, "LOAD: Expected --key=value, got %s\n", argv[i]); return false; }
+        const std::string key = a.substr(2, eq - 2), v = a.substr(eq + 1);
+        bool ok = true;
+        if (key == "host") o.host = v;
+        else if (key == "port") ok = (o.port = atoi(v.c_str())) > 0;
+        else if (key == "token") o.token = v;
+        else if (key == "concurrency") ok = (o.concurrency = atoi(v.c_str())) >= 1 && o.concurrency <= 256;
+        else if (key == "duration") ok = (o.duration = atoi(v.c_str())) >= 1;
+        else if (key == "settle") ok = (o.settle = atoi(v.c_str())) >= 0;
+        else if (key == "mix") ok = parse_weights(v, KIND_NAMES, KIND_COUNT, o.mix);
+        else if (key == "payloads") ok = parse_weights(v, PAYLOAD_NAMES, PAYLOAD_COUNT, o.payloads);
+        else if (key == "replay") o.replay = v;
+        else if (key == "etag") o.etag = atoi(v.c_str()) != 0;
+        else if (key == "max-drop") ok = (o.maxDrop = (float)atof(v.c_str())) >= 0;
+        else if (key == "seed") o.seed = (unsigned)strtoul(v.c_str(), nullptr, 10);
+        else if (key == "rates") {
+            o.rates.clear();
+            std::stringstream ss(v);
+            for (std::string r; std::getline(ss, r, ','); ) o.rates.push_back(atoi(r.c_str()));
+            for (int r : o.rates) ok &= r >= 0;
+            ok &= !o.rates.empty();
+        } else {
+            fprintf(stderr, "LOAD: Unknown option --%s\n", key.c_str());
+            return false;
+        }
+        if (!ok) { fprintf(stderr, "LOAD: Invalid value for --%s: %s\n", key.c_str(), v.c_str()); return false; }
+    }
+    return true;
+}
+
+// =======================================================
+// SERVER METRICS
+// =======================================================
+
+/**
+ * One scrape of GET /metrics: every sample keyed by its series name with
+ * labels exactly as the server prints them, e.g.
+ * `ledcube_frame_stage_seconds{stage="busy",quantile="0.99"}`.
+ */
+struct MetricsSample {
+    bool ok = false;
+    std::chrono::steady_clock::time_point at;
+    std::map<std::string, double> values;
+
+    double get(const std::string &series) const {
+        auto it = values.find(series);
+        return it == values.end() ? 0.0 : it->second;
+    }
+};
+
+static MetricsSample scrape_metrics(httplib::Client &cli) {
+    MetricsSample m;
+    m.at = std::chrono::steady_clock::now();
+    auto res = cli.Get("/metrics", httplib::Headers());
+    if (!res || res->status != 200) return m;
+    std::istringstream in(res->body);
+    for (std::string line; std::getline(in, line); ) {
+        if (line.empty() || line[0] == '#') continue;
+        size_t sp = line.rfind(' ');
+        if (sp == std::string::npos) continue;
+        m.values[line.substr(0, sp)] = atof(line.c_str() + sp + 1);
+    }
+    m.ok = true;
+    return m;
+}
+
+// =======================================================
+// TRAFFIC
+// =======================================================
+
+/**
+ * Request generator of one worker. Synthetic bodies are drawn from the
+ * payload weights; replayed bodies cycle through the file, each worker
+ * starting at a different line.
+ */
+class Traffic {
+public:
+    Traffic(const Options &o, const std::vector<std::string> &replay, int worker)
+        : o_(o), replay_(replay), rng_(o.seed * 7919u + (unsigned)worker), next_(worker) {}
+
+    Kind kind() { return (Kind)pick(o_.mix); }
+
+    std::string update_body() {
+        if (!replay_.empty()) return replay_[next_++ % replay_.size()];
+        static const char *const GEOMS[] = { "ring", "circle", "square", "triangle", "x" };
+        std::ostringstream b;
+        switch (pick(o_.payloads)) {
+        case PAYLOAD_HEAT:
+            b << "{\"mode\":\"heat\",\"colour\":" << uniform(0, 100) << ",\"width\":" << uniform(10, 80)
+              << ",\"percent\":" << uniform(0, 100) / 100.0 << "}";
+            break;
+        case PAYLOAD_CUSTOM:
+            b << "{\"mode\":\"custom\",\"geometry\":\"" << GEOMS[uniform(0, 4)] << "\",\"width\":" << uniform(5, 100)
+              << ",\"percent\":" << uniform(0, 100) / 100.0 << ",\"elementColor\":\"" << colour()
+              << "\",\"backgroundColor\":\"" << colour() << "\"}";
+            break;
+        case PAYLOAD_SEGMENTS:
+            b << "{\"mode\":\"heat\",\"colour\":" << uniform(0, 100) << ",\"segments\":[";
+            for (int i = 0; i < 10; i++) b << (i ? "," : "") << uniform(0, 100);
+            b << "]}";
+            break;
+        default:
+            b << "{\"mode\":\"custom\",\"geometry\":\"" << GEOMS[uniform(0, 4)] << "\",\"width\":" << uniform(5, 100)
+              << ",\"percent\":1,\"elementColor\":\"" << colour() << "\",\"elements\":[";
+            for (int i = 0; i < 2; i++)
+                b << (i ? "," : "") << "{\"geometry\":\"" << GEOMS[uniform(0, 4)] << "\",\"radius\":" << uniform(10, 90)
+                  << ",\"width\":" << uniform(5, 60) << ",\"percent\":" << uniform(10, 100) / 100.0
+                  << ",\"color\":\"" << colour() << "\"}";
+            b << "]}";
+            break;
+        }
+        return b.str();
+    }
+
+private:
+    int uniform(int lo, int hi) { return std::uniform_int_distribution<int>(lo, hi)(rng_); }
+
+    int pick(const std::vector<int> &weights) {
+        int total = 0;
+        for (int w : weights) total += w;
+        int r = uniform(0, total - 1), i = 0;
+        while (r >= weights[i]) r -= weights[i++];
+        return i;
+    }
+
+    std::string colour() {
+        char c[8];
+        snprintf(c, sizeof(c), "#%06x", uniform(0, 0xffffff));
+        return c;
+    }
+
+    const Options &o_;
+    const std::vector<std::string> &replay_;
+    std::mt19937 rng_;
+    size_t next_;
+};
+
+// Outcome of one worker over one step
+struct WorkerResult {
+    uint64_t sent[KIND_COUNT] = {};
+    uint64_t errors = 0;
+    std::vector<uint32_t> latencyUs[KIND_COUNT];
+};
+
+/**
+ * Sends for `duration` seconds at `rate` requests per second (this worker's
+ * share), on an absolute schedule offset by `phase` so the workers
+ * interleave. rate 0 sends back to back.
+ */
+static void run_worker(const Options &o, const std::vector<std::string> &replay, int worker,
+                       double rate, double phase, WorkerResult &out) {
+    httplib::Client cli(o.host, o.port);
+    cli.set_keep_alive(true);
+    cli.set_connection_timeout(2, 0);
+    cli.set_read_timeout(5, 0);
+    Traffic traffic(o, replay, worker);
+    const httplib::Headers auth = { { "X-API-Token", o.token } };
+    std::string etag;
+
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+    const auto end = start + std::chrono::seconds(o.duration);
+    const auto period = rate > 0 ? std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / rate))
+                                 : clock::duration::zero();
+    auto due = start + std::chrono::duration_cast<clock::duration>(period * phase);
+
+    while (!interrupt_received) {
+        if (rate > 0) {
+            if (due >= end) break;
+            std::this_thread::sleep_until(due);
+        } else {
+            due = clock::now();
+            if (due >= end) break;
+        }
+
+        const Kind k = traffic.kind();
+        httplib::Result res;
+        if (k == KIND_UPDATE) {
+            res = cli.Post("/update", auth, traffic.update_body(), "application/json");
+        } else if (k == KIND_STATUS) {
+            httplib::Headers h;
+            if (o.etag && !etag.empty()) h.emplace("If-None-Match", etag);
+            res = cli.Get("/status", h);
+            if (res && res->status == 200) etag = res->get_header_value("ETag");
+        } else {
+            res = cli.Get("/config", httplib::Headers());
+        }
+        const auto done = clock::now();
+
+        out.sent[k]++;
+        out.latencyUs[k].push_back((uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(done - due).count());
+        if (!res || (res->status / 100 != 2 && res->status != 304)) out.errors++;
+        due += period;
+    }
+}
+
+// =======================================================
+// REPORT
+// =======================================================
+
+// Nearest-rank quantile in milliseconds (reorders v)
+static double quantile_ms(std::vector<uint32_t> &v, double q) {
+    if (v.empty()) return 0.0;
+    size_t k = (size_t)std::min<double>(v.size() - 1, q * v.size());
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k] / 1000.0;
+}
+
+static void print_header() {
+    printf("%6s %7s %7s %5s %7s %7s %7s %7s %6s %6s %7s %8s %4s %7s %7s\n", "rate", "sent", "rps", "err", "p50_ms", "p99_ms",
+           "max_ms", "upd_p99", "fps", "drop%", "busy_ms", "busy_p99", "gov", "applied", "merged");
+    fflush(stdout);
+}
+
+/**
+ * One table line for a step; `rps` is the achieved request rate. Returns
+ * true when the cube kept up: no client errors, dropped frames within
+ * max-drop, and the governor still at the configured frame rate.
+ */
+static bool report_step(const Options &o, int rate, double seconds, std::vector<WorkerResult> &workers,
+                        const MetricsSample &m0, const MetricsSample &m1, int targetFps, double &rps) {
+    uint64_t sent = 0, errors = 0;
+    std::vector<uint32_t> all, updates;
+    for (WorkerResult &w : workers) {
+        errors += w.errors;
+        for (int k = 0; k < KIND_COUNT; k++) {
+            sent += w.sent[k];
+            all.insert(all.end(), w.latencyUs[k].begin(), w.latencyUs[k].end());
+        }
+        updates.insert(updates.end(), w.latencyUs[KIND_UPDATE].begin(), w.latencyUs[KIND_UPDATE].end());
+    }
+
+    const double window = std::chrono::duration<double>(m1.at - m0.at).count();
+    const double frames = m1.get("ledcube_frames_total") - m0.get("ledcube_frames_total");
+    const double dropped = m1.get("ledcube_frames_dropped_total") - m0.get("ledcube_frames_dropped_total");
+    const double busySum = m1.get("ledcube_frame_stage_seconds_sum{stage=\"busy\"}") - m0.get("ledcube_frame_stage_seconds_sum{stage=\"busy\"}");
+    const double dropPct = frames > 0 ? 100.0 * dropped / frames : 0.0;
+    const int gov = (int)m1.get("ledcube_governor_fps");
+    rps = seconds > 0 ? sent / seconds : 0.0;
+
+    printf("%6d %7llu %7.1f %5llu %7.2f %7.2f %7.2f %7.2f %6.1f %6.2f %7.2f %8.2f %4d %7.0f %7.0f\n",
+           rate, (unsigned long long)sent, rps, (unsigned long long)errors,
+           quantile_ms(all, 0.5), quantile_ms(all, 0.99), quantile_ms(all, 1.0), quantile_ms(updates, 0.99),
+           window > 0 ? frames / window : 0.0, dropPct, frames > 0 ? 1000.0 * busySum / frames : 0.0,
+           1000.0 * m1.get("ledcube_frame_stage_seconds{stage=\"busy\",quantile=\"0.99\"}"), gov,
+           m1.get("ledcube_updates_total{result=\"applied\"}") - m0.get("ledcube_updates_total{result=\"applied\"}"),
+           m1.get("ledcube_updates_total{result=\"merged\"}") - m0.get("ledcube_updates_total{result=\"merged\"}"));
+    fflush(stdout);
+    return errors == 0 && dropPct <= o.maxDrop && (targetFps <= 0 || gov >= targetFps);
+}
+
+// =======================================================
+// MAIN
+// =======================================================
+
+int main(int argc, char *argv[]) {
+    Options o;
+    if (!parse_options(argc, argv, o)) return EXIT_FAILURE;
+    signal(SIGINT, InterruptHandler); signal(SIGTERM, InterruptHandler);
+
+    std::vector<std::string> replay;
+    if (!o.replay.empty()) {
+        std::ifstream in(o.replay);
+        for (std::string line; std::getline(in, line); )
+            if (line.find_first_not_of(" \t\r") != std::string::npos) replay.push_back(line);
+        if (replay.empty()) { fprintf(stderr, "LOAD: No /update bodies in %s\n", o.replay.c_str()); return EXIT_FAILURE; }
+        fprintf(stderr, "LOAD: Replaying %zu update(s) from %s\n", replay.size(), o.replay.c_str());
+    }
+
+    // The configured frame rate is the bar for "pacing holds"
+    httplib::Client cli(o.host, o.port);
+    cli.set_connection_timeout(2, 0);
+    cli.set_read_timeout(5, 0);
+    int targetFps = 0;
+    auto cfg = cli.Get("/config", httplib::Headers());
+    if (!cfg || cfg->status != 200) { fprintf(stderr, "LOAD: No controller at %s:%d\n", o.host.c_str(), o.port); return EXIT_FAILURE; }
+    size_t pos = cfg->body.find("\"targetFps\":");
+    if (pos != std::string::npos) targetFps = atoi(cfg->body.c_str() + pos + 12);
+    if (!scrape_metrics(cli).ok) fprintf(stderr, "LOAD: GET /metrics failed, server columns will be empty\n");
+    fprintf(stderr, "LOAD: %s:%d at %d fps, %d worker(s), %d s per step\n", o.host.c_str(), o.port, targetFps, o.concurrency, o.duration);
+
+    print_header();
+    double sustained = -1.0;   // achieved rate of the last step before pacing first failed
+    bool failed = false;
+    for (size_t s = 0; s < o.rates.size() && !interrupt_received; s++) {
+        if (s > 0 && o.settle > 0) std::this_thread::sleep_for(std::chrono::seconds(o.settle));
+        const int rate = o.rates[s];
+        std::vector<WorkerResult> results(o.concurrency);
+        std::vector<std::thread> threads;
+
+        const MetricsSample m0 = scrape_metrics(cli);
+        const auto t0 = std::chrono::steady_clock::now();
+        for (int w = 0; w < o.concurrency; w++)
+            threads.emplace_back(run_worker, std::cref(o), std::cref(replay), w, (double)rate / o.concurrency,
+                                 (double)w / o.concurrency, std::ref(results[w]));
+        for (std::thread &t : threads) t.join();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        const MetricsSample m1 = scrape_metrics(cli);
+
+        double rps;
+        if (report_step(o, rate, seconds, results, m0, m1, targetFps, rps) && !failed) sustained = rps;
+        else failed = true;
+    }
+
+    if (sustained >= 0)
+        fprintf(stderr, "LOAD: Pacing held up to %.1f requests/s (%d%% /update)%s\n", sustained,
+                100 * o.mix[KIND_UPDATE] / (o.mix[KIND_UPDATE] + o.mix[KIND_STATUS] + o.mix[KIND_CONFIG]),
+                failed ? "" : ", the highest step tried");
+    else
+        fprintf(stderr, "LOAD: Pacing did not hold at the first step\n");
+    return 0;
+}
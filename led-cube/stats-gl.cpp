@@ -7,7 +7,8 @@
  * - Panels: 3x 64x64 RGB LED Panels (FM6126A chips)
  * - Total Resolution: 192x64 pixels
  * - Orientation: 
- * - Panel 0 (Top): Coordinates locally flipped via map_xy to align circle flow.
+ * - Panel 0 (Top): Coordinates locally flipped via map_xy to align circle flow
+ *   (baked into the strip geometry when GPU_REMAP is enabled).
  * - Panel 1 (Left): Standard alignment.
  * - Panel 2 (Right): Standard alignment.
  * - Hardware Mapping: adafruit-hat-pwm
@@ -20,6 +21,10 @@
  * The system uses a procedural fragment shader to create a "Magic Shine" 
  * background with an interactive geometry element in front.
  *
+ * PIPELINED_RENDER draws frame N+1 into one of two FBOs while a copy thread
+ * pushes frame N into the FrameCanvas and waits for SwapOnVSync, so GPU
+ * rendering and the CPU copy overlap (at the cost of one frame of latency).
+ *
  * BACKWARD COMPATIBILITY NOTE:
  * The "segments" array logic has been replaced by "percent" (arc coverage) 
  * and "width" (uniform thickness). While the API still parses segment data 
@@ -40,6 +45,8 @@
  * 1) POST /update
  * --------------------------------------------------------------------
  * Update the visual state. Supports both legacy "heat" and new "custom" modes.
+ * The body must be one JSON object; unknown keys are ignored, a malformed
+ * body or a wrongly typed known key rejects the whole request (400).
  *
  * EXAMPLE: New "Custom" Payload
  * {
@@ -48,7 +55,9 @@
  * "width": 60,                // 0..100: How fat the line is
  * "percent": 0.5,             // 0..1:   How much of the shape is drawn fat
  * "elementColor": "#00FF00",  // The color of the square itself
- * "backgroundColor": "#110022"// The background shimmer tint
+ * "backgroundColor": "#110022",// The background shimmer tint
+ * "elements": [               // Up to 4 layers in front, same pass
+ *   { "geometry": "ring", "radius": 30, "width": 40, "percent": 0.8, "color": "#FF8800" } ]
  * }
  *
  * EXAMPLE: Legacy "Heat" Payload (Auto-translated)
@@ -65,10 +74,51 @@
  * --------------------------------------------------------------------
  * Returns the current interpolated live values and signal age.
  * Response: { "colour": 15.0, "width": 47.0, "percent": 0.74, "age": 0.5, ... }
+ * Rebuilt at most 10x per second and sent with an ETag; a matching
+ * If-None-Match gets 304. GET /events (port 8082) pushes it instead.
+ *
+ * 3) GET /config, POST /config
+ * --------------------------------------------------------------------
+ * Active settings: { "width": 192, "height": 64, "targetFps": 40, ... }
+ * POST changes the live subset without a restart:
+ * { "targetFps": 30, "animStep": 40, "grayStart": 20, "grayEnd": 25 }
+ *
+ * 4) GET /metrics
+ * --------------------------------------------------------------------
+ * Prometheus text format: per-stage frame time quantiles (p50/p95/p99)
+ * over the last 512 frames, frame and dropped-frame counters.
+ *
+ * 5) UDP port 8081 (binary, optional)
+ * --------------------------------------------------------------------
+ * UdpUpdatePacket datagrams for high-rate telemetry; same
+ * fields and rules as POST /update, token sent as its FNV-1a hash,
+ * out-of-order packets dropped by sequence number. See UDP API below.
+ *
+ * 6) POST /timeline
+ * --------------------------------------------------------------------
+ * Up to 128 keyframes played back by the render loop with easing
+ * ("linear", "step", "in", "out", "in-out": curve towards the next key):
+ * { "loop": true, "keyframes": [ { "t": 0, "percent": 0, "ease": "in-out" },
+ *                                { "t": 2, "percent": 1, "geometry": "x" } ] }
+ * Keyframe fields are /update fields applied cumulatively. "keyframes": []
+ * stops playback; any /update (REST or UDP) takes over from a timeline.
+ *
+ * 7) GET /preview, /preview.jpg, /events (port 8082, optional)
+ * --------------------------------------------------------------------
+ * Live MJPEG stream / single JPEG of what the matrix shows, downscaled
+ * and rate limited, and the /status body as Server-Sent Events, one per
+ * change; the API port redirects all three. See STREAM PORT.
+ *
+ * 8) Fleet sync (multicast 239.255.76.67:8083, sync=leader|follower)
+ * --------------------------------------------------------------------
+ * The leader multicasts its animation clock and target; followers apply
+ * the target and phase-lock their clock to it. See FLEET SYNC.
  *
- * 3) GET /config
+ * 9) POST /shader, DELETE /shader
  * --------------------------------------------------------------------
- * Static info: { "width": 192, "height": 64, "targetFps": 40, ... }
+ * Body: a GLSL fragment shader that replaces the built-in programs
+ * (compiled off the render thread, swapped between frames; 400 with the
+ * compiler log). DELETE restores the built-ins. See USER SHADERS.
  *
  * ====================================================================
  * SHADER LOGIC & COLOR RULES
@@ -86,30 +136,67 @@
  * COMPILATION & RESOURCES
  * ====================================================================
  * Linker flags: -lrgbmatrix -lEGL -lGLESv2 -lpthread
+ * Options: --config=PATH (key = value file), or any key as --key=value:
+ *          api-token, api-port, udp-port, panel-size, segments,
+ *          blank-interval, bg-scale, bg-interval, fps, anim-step,
+ *          gray-start, gray-end, governor, max-bg-scale, renderer,
+ *          render-threads, refresh-core, capture, capture-frames,
+ *          sync, sync-group, sync-port, log-format, log-rate,
+ *          gamma, white-balance, heat-palette, shader, shader-cache,
+ *          thermal, thermal-limit,
+ *          stream-port, preview-fps, preview-scale, preview-quality;
+ *          led-* keys go to the matrix library.
+ * Benchmark: -DLEDCUBE_BENCHMARK builds a headless, uncapped run of scripted
+ *          scenarios on a null matrix (no -lrgbmatrix); options
+ *          bench-frames, bench-replay, bench-golden.
  * Dependencies:
  * - rpi-rgb-led-matrix (Henner Zeller)
  * - cpp-httplib (yhirose)
- * - nlohmann/json
  * ====================================================================
  */
 
+#ifndef LEDCUBE_BENCHMARK
 #include "led-matrix.h"
+#endif
 #include "httplib.h"
 
 #include <signal.h>
 #include <EGL/egl.h>
 #include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sched.h>
+#include <time.h>
 #include <string.h>
 #include <math.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <pwd.h>
+#include <grp.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define LEDCUBE_NEON 1
+#endif
 
 #include <thread>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
 #include <vector>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <sstream>
+#include <fstream>
 #include <chrono>
 #include <ctime>
 #include <iomanip>
@@ -129,31 +216,165 @@ namespace compat {
 // =======================================================
 // HARDWARE & API CONFIGURATION
 // =======================================================
-static const std::string API_TOKEN = "1234567890";
-static const int API_PORT = 8080;
+#define MAX_SEGMENTS 64       // Capacity of the segment arrays (the count is Config::segments)
+#define NUM_PANELS 3          // Cube faces, one square panel each
+
+/**
+ * Start-up configuration: the defaults below, then a key=value config file
+ * (--config=PATH), then --key=value flags (see RUNTIME OPTIONS). Written once
+ * in main() before any other thread starts and read-only afterwards.
+ */
+struct Config {
+    std::string apiToken = "1234567890";
+    int apiPort = 8080;
+    int udpPort = 8081;         // Binary update channel (0 disables it)
+    int blankInterval = 0;      // Seconds of inactivity before blanking the display (0: never)
+    int panelSize = 64;         // Edge of one cube face in pixels (the matrix is 3 faces wide)
+    int segments = 10;          // Interactive segments around the shape (1..MAX_SEGMENTS)
+    int bgScale = 1;            // Plasma background at 1/N resolution (1: full-res, inline)
+    int bgInterval = 1;         // Re-render that background every N frames
+    int governor = 1;           // Adapt the frame rate to the measured frame cost (0: fixed rate)
+    int maxBgScale = 0;         // Governor may coarsen the background up to 1/N (0: never)
+    std::string renderer = "auto";  // "gpu" (GLES2), "cpu" (CPU renderer) or "auto" (GPU if EGL works)
+    std::string shader;         // User fragment shader file, reloaded when it changes (empty: built-in)
+    std::string shaderCache;    // Directory for linked program binaries (empty: compile every start)
+    int renderThreads = 0;      // Worker pool threads including the caller (0: every core but refreshCore)
+    int refreshCore = 3;        // Core of the matrix refresh thread, kept free of our threads (-1: no pinning)
+    int streamPort = 8082;      // Preview stream and status events (0 disables both)
+    int previewFps = 5;         // Preview frames per second
+    int previewScale = 2;       // Preview at 1/N of the matrix resolution
+    int previewQuality = 85;    // JPEG quality of the preview (1..100)
+    std::string capture;        // Record the post-readback frames to this file (empty: off)
+    int captureFrames = 0;      // Stop recording after N frames (0: no limit)
+    std::string sync = "off";   // Fleet sync role: "off", "leader" or "follower"
+    std::string syncGroup = "239.255.76.67";   // Multicast group of the fleet
+    int syncPort = 8083;        // UDP port of the fleet sync packets
+    float gamma = 1.0f;         // Output tone curve exponent applied in the copy stage (1: off)
+    float whiteBalance[3] = { 1.0f, 1.0f, 1.0f };  // Per-channel output gain (white-balance = #RRGGBB)
+    std::string heatPalette;    // Heat colour stops "pos:#RRGGBB,..." (empty: built-in ramp)
+    std::string logFormat = "text";     // "text" ([HH:MM:SS] lines) or "json" (one object per line)
+    int logRate = 10;           // Log lines per second and category, bursts of LOG_BURST (0: no limit)
+    int thermal = 1;            // Step fps, background, brightness and PWM depth down as the SoC heats up
+    float thermalLimit = 80.0f; // SoC temperature (C) of the top tier; lower tiers start below it
+#ifdef LEDCUBE_BENCHMARK
+    int benchFrames = 200;      // Measured frames per benchmark scenario
+    std::string benchReplay;    // File of /update bodies (one per line) for the replay scenario
+    std::string benchGolden;    // Capture file to compare the measured frames against
+#endif
+    std::vector<std::string> matrixFlags;   // led-* keys of the config file, as --led-* flags
+};
 
-#define BLANKINTERVAL 0       // Seconds of inactivity before blanking the display
-#define ANIMSTEP 40.0f        // Speed of color/segment transitions (units per second)
-#define W 192                 // Total matrix width (e.g., 3x 64px panels)
-#define H 64                  // Matrix height
-#define SEGMENTS 10           // Number of interactive segments in the shader
+/**
+ * The subset POST /config can change at runtime. The API owns the master copy
+ * (g_liveConfig, guarded by config_mtx) and publishes it to the render loop
+ * through g_liveConfigBuf, like the visual target.
+ */
+struct LiveConfig {
+    int targetFps = 40;
+    float animStep = 40.0f;     // Speed of color/segment transitions (units per second)
+    float grayStart = 60.0f;    // Seconds after the last update before the background starts to gray
+    float grayEnd = 70.0f;      // ... and before it is fully gray
+    uint32_t generation = 0;    // bumped by every accepted POST /config
+};
 
-static const int TARGET_FPS = 40;
+static Config g_cfg;
+static LiveConfig g_liveConfig;
+
+// Framebuffer geometry, derived from Config::panelSize before anything is sized
+static int PANEL_W = 64;
+static int W = NUM_PANELS * 64;     // Total matrix width (3x 64px panels)
+static int H = 64;                  // Matrix height
 
 #define CT1 40.0
 #define CT2 60.0
 #define CT3 80.0
 
+// =======================================================
+// NULL MATRIX (benchmark build)
+// =======================================================
+#ifdef LEDCUBE_BENCHMARK
+/**
+ * In-memory stand-in for the parts of rpi-rgb-led-matrix that main() uses,
+ * so the benchmark build (-DLEDCUBE_BENCHMARK) runs the unchanged render
+ * pipeline without panels or librgbmatrix. A FrameCanvas keeps its frame as
+ * packed RGB and SwapOnVSync() returns at once, so the loop runs uncapped.
+ * led-* flags are accepted and ignored. SetPixel() is a plain store and much
+ * cheaper than the real bit-plane update, so "copy" times are a lower bound.
+ */
+namespace rgb_matrix {
+class Canvas {
+public:
+    virtual ~Canvas() {}
+    virtual int width() const = 0;
+    virtual int height() const = 0;
+    virtual void SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) = 0;
+    virtual void Clear() = 0;
+};
+
+class FrameCanvas : public Canvas {
+public:
+    FrameCanvas(int w, int h) : w_(w), h_(h), px_((size_t)w * h * 3, 0) {}
+    int width() const override { return w_; }
+    int height() const override { return h_; }
+    void SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) override {
+        if (x < 0 || y < 0 || x >= w_ || y >= h_) return;
+        uint8_t *p = &px_[((size_t)y * w_ + x) * 3];
+        p[0] = r; p[1] = g; p[2] = b;
+    }
+    void Clear() override { std::fill(px_.begin(), px_.end(), 0); }
+    const std::vector<uint8_t> &pixels() const { return px_; }
+    void SetBrightness(uint8_t b) { brightness_ = b; }     // stored, not applied
+    uint8_t brightness() { return brightness_; }
+    bool SetPWMBits(uint8_t v) { pwmBits_ = v; return true; }
+    uint8_t pwmbits() { return pwmBits_; }
+
+private:
+    int w_, h_;
+    std::vector<uint8_t> px_;
+    uint8_t brightness_ = 100, pwmBits_ = 11;
+};
+
+struct RuntimeOptions { int gpio_slowdown = 1; int daemon = 0; int drop_privileges = 1; };
+
+class RGBMatrix {
+public:
+    struct Options {
+        const char *hardware_mapping = "regular", *led_rgb_sequence = "RGB", *panel_type = "";
+        int rows = 32, cols = 32, pwm_bits = 11;
+    };
+    RGBMatrix(int w, int h) : w_(w), h_(h) {}
+    ~RGBMatrix() { for (FrameCanvas *c : canvases_) delete c; }
+    int width() const { return w_; }
+    int height() const { return h_; }
+    uint8_t brightness() { return 100; }
+    uint8_t pwmbits() { return 11; }
+    FrameCanvas *CreateFrameCanvas() {
+        canvases_.push_back(new FrameCanvas(w_, h_));
+        return canvases_.back();
+    }
+    // Shows `c` and hands back the previously shown canvas (a fresh one the first time)
+    FrameCanvas *SwapOnVSync(FrameCanvas *c) {
+        FrameCanvas *prev = shown_ ? shown_ : CreateFrameCanvas();
+        shown_ = c;
+        return prev;
+    }
+
+private:
+    int w_, h_;
+    FrameCanvas *shown_ = nullptr;
+    std::vector<FrameCanvas *> canvases_;
+};
+
+static inline RGBMatrix *CreateMatrixFromFlags(int *, char ***, RGBMatrix::Options *o, RuntimeOptions *) {
+    return new RGBMatrix(o->cols, o->rows);
+}
+} // namespace rgb_matrix
+#endif
+
 using rgb_matrix::RGBMatrix;
 using rgb_matrix::Canvas;
 using rgb_matrix::FrameCanvas;
 
-// Time (in seconds) after last update before graying starts (important: don't use XX.Xf here as the smoothstep in the shader has problems with that)
-#define GRAY_START_TIME 60.0
-
-// Time (in seconds) after last update before fully gray (important: don't use XX.Xf here as the smoothstep in the shader has problems with that)
-#define GRAY_END_TIME 70.0
-
 // =======================================================
 // PANEL / ORIENTATION FIXES
 // =======================================================
@@ -161,17 +382,44 @@ static const bool MAP_FLIP_X = false;
 static const bool MAP_FLIP_Y = false;
 static const bool MAP_REVERSE_PANELS = false;
 
-static const int PANEL_W = 64;
-static const int NUM_PANELS = W / PANEL_W;
+// Bake the orientation fixes above into the strip geometry so glReadPixels
+// already returns LED order (false: orientation is applied by the CPU LUT)
+static const bool GPU_REMAP = true;
+
+// Pipelined rendering: frame N+1 is drawn while a copy thread pushes frame N
+// into the FrameCanvas (two FBOs + two host buffers, adds one frame of latency)
+static const bool PIPELINED_RENDER = true;
+
+// Render into an explicit RGBA8 FBO and read back GL_RGBA (the native
+// VideoCore IV format) instead of converting to GL_RGB inside glReadPixels
+static const bool READBACK_RGBA = true;
+
+// Skip all GL work while the output cannot change (time frozen, grayscale fade
+// complete, interpolation settled, no new update) and poll at IDLE_FPS instead
+static const bool SKIP_STATIC_FRAMES = true;
+static const int IDLE_FPS = 5;
+
+// Compile one fragment program per geometry x full-arc case so each fragment
+// only runs the code its shape needs (false: one program branching on u_geom)
+static const bool SPECIALIZE_SHADERS = true;
+
+// Benchmark build: null matrix, no API threads, scripted scenarios, uncapped loop
+#ifdef LEDCUBE_BENCHMARK
+static const bool BENCHMARK = true;
+#else
+static const bool BENCHMARK = false;
+#endif
+// Benchmark animation step: frame n always shows time n * BENCH_DT, so runs are reproducible
+static const float BENCH_DT = 1.0f / 40;
 
 static inline void map_xy(int x, int y, int &mx, int &my) {
     mx = x; 
     my = y;
 
     // Check if we  addressing the TOP panel (Panel 0)
-    if (mx < 64) {
+    if (mx < PANEL_W) {
         // The top panel needs its X mirrored to align the 'arc' flow.
-        mx = 63 - mx; 
+        mx = (PANEL_W - 1) - mx; 
     }
 
     // Standard global fixes (Keep these false as per your saved info)
@@ -186,44 +434,466 @@ static inline void map_xy(int x, int y, int &mx, int &my) {
     }
 }
 
+// =======================================================
+// WORKER POOL & CORE PINNING
+// =======================================================
+/**
+ * Takes `core` out of the calling thread's CPU affinity mask. Threads inherit
+ * the mask, so calling this before any thread exists keeps the whole process
+ * (HTTP pool, UDP, copy thread, render workers, driver threads) off the core
+ * the rpi-rgb-led-matrix refresh thread pins itself to (core 3 on a Pi 2).
+ * The refresh thread sets its own affinity and is not restricted by this.
+ * Returns false (mask unchanged) if `core` is not in the mask, is the only
+ * core in it or cannot be removed. `cores` receives the cores left to us.
+ */
+static bool avoid_core(int core, int &cores) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    cores = std::max(1, (int)std::thread::hardware_concurrency());
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return false;
+    cores = CPU_COUNT(&set);
+    if (core < 0 || core >= CPU_SETSIZE || !CPU_ISSET(core, &set) || cores < 2) return false;
+    CPU_CLR(core, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) return false;
+    cores--;
+    return true;
+}
+
+/**
+ * Persistent worker threads for data-parallel frame work. run(n, fn) calls
+ * fn(0) .. fn(n-1) spread over the workers and the calling thread, and
+ * returns once every call (and every worker) is done.
+ *
+ * The render thread and the copy thread share one pool. If a job is already
+ * running, run() executes the other caller's items inline instead of
+ * queueing behind it, so neither stage waits for the other.
+ *
+ * Each job has its own state block on the caller's stack. Workers join it
+ * only while it is published and has unclaimed items, and run() unpublishes
+ * it before waiting, so a worker that wakes late never touches a finished
+ * job or mixes one job's count with another job's function.
+ */
+class WorkerPool {
+public:
+    explicit WorkerPool(int workers) {
+        for (int i = 0; i < workers; i++) threads_.emplace_back([this] { loop(); });
+    }
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            quit_ = true;
+        }
+        wake_.notify_all();
+        for (std::thread &t : threads_) t.join();
+    }
+
+    int threads() const { return (int)threads_.size() + 1; }
+
+    void run(int n, const std::function<void(int)> &fn) {
+        std::unique_lock<std::mutex> owner(submit_, std::try_to_lock);
+        if (!owner.owns_lock() || threads_.empty()) {
+            for (int i = 0; i < n; i++) fn(i);
+            return;
+        }
+        Job job(fn, n);
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            job_ = &job;
+            generation_++;
+        }
+        wake_.notify_all();
+        work(job);
+        std::unique_lock<std::mutex> lk(mtx_);
+        job_ = nullptr;                 // no worker joins after this
+        done_.wait(lk, [this] { return busy_ == 0; });
+    }
+
+private:
+    struct Job {
+        Job(const std::function<void(int)> &f, int n) : fn(f), count(n) {}
+        const std::function<void(int)> &fn;
+        const int count;
+        std::atomic<int> next{0};
+    };
+
+    void loop() {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lk(mtx_);
+        for (;;) {
+            wake_.wait(lk, [&] { return quit_ || (job_ && generation_ != seen); });
+            if (quit_) return;
+            seen = generation_;
+            Job *job = job_;
+            if (job->next.load() >= job->count) continue;
+            busy_++;
+            lk.unlock();
+            work(*job);
+            lk.lock();
+            if (--busy_ == 0) done_.notify_one();
+        }
+    }
+
+    // Claims items until none are left
+    static void work(Job &job) {
+        for (int i; (i = job.next.fetch_add(1)) < job.count; ) job.fn(i);
+    }
+
+    std::vector<std::thread> threads_;
+    std::mutex submit_;                 // held by the caller whose job is running
+    std::mutex mtx_;
+    std::condition_variable wake_, done_;
+    Job *job_ = nullptr;                // published job, guarded by mtx_
+    uint64_t generation_ = 0;
+    int busy_ = 0;
+    bool quit_ = false;
+};
+
+// =======================================================
+// PIXEL REMAP LUT
+// =======================================================
+/**
+ * Precomputed readback -> LED matrix remap (built once at startup).
+ *
+ * map_xy() is separable: the X fix-ups (panel-0 mirror, MAP_FLIP_X,
+ * MAP_REVERSE_PANELS) only depend on x and MAP_FLIP_Y only depends on y.
+ * The full 192x64 remap therefore collapses into one destination column per
+ * source column and one destination row per source row. The row table also
+ * absorbs the GL bottom-left origin, so blit_to_canvas() walks the readback
+ * buffer strictly front to back without any per-pixel branching or division.
+ *
+ * With GPU_REMAP the strip geometry already renders every pixel at its final
+ * matrix position (see build_strip_geometry()), the tables degenerate to the
+ * identity and blit_to_canvas() becomes a straight row transfer.
+ */
+static std::vector<int> lut_dst_x;   // readback column -> matrix x
+static std::vector<int> lut_dst_y;   // readback row (GL, bottom-up) -> matrix y
+static bool lut_identity = false;
+
+static void build_remap_lut(bool gpu_remap) {
+    int mx, my;
+    lut_dst_x.resize(W); lut_dst_y.resize(H);
+    for (int x = 0; x < W; x++) {
+        map_xy(x, 0, mx, my);
+        lut_dst_x[x] = gpu_remap ? x : mx;
+    }
+    for (int gl_y = 0; gl_y < H; gl_y++) {
+        // OpenGL (0,0) is bottom-left → LED matrix expects top-left
+        map_xy(0, (H - 1) - gl_y, mx, my);
+        lut_dst_y[gl_y] = gpu_remap ? gl_y : my;
+    }
+    lut_identity = gpu_remap;
+}
+
+/**
+ * Per-channel output curve of the copy stage: out = gain * in^gamma, one
+ * table lookup per channel instead of a pow() per pixel. Built once at
+ * start-up from gamma and white-balance; with the defaults it is the
+ * identity and blit_columns() skips it. SetPixel() still takes 8 bits per
+ * channel, which the matrix library spreads over its PWM depth with its own
+ * luminance correction, so this tunes the panel response rather than adding
+ * levels.
+ */
+static uint8_t lut_tone[3][256];
+static bool tone_identity = true;
+
+static void build_tone_lut(float gamma, const float gain[3]) {
+    tone_identity = gamma == 1.0f && gain[0] == 1.0f && gain[1] == 1.0f && gain[2] == 1.0f;
+    for (int c = 0; c < 3; c++)
+        for (int v = 0; v < 256; v++)
+            lut_tone[c][v] = (uint8_t)lrintf(compat::clamp(gain[c] * powf(v / 255.0f, gamma), 0.0f, 1.0f) * 255.0f);
+}
+
+// One readback pixel. RGBA frames are fetched with a single 32-bit load.
+template<int BPP>
+static inline void load_pixel(const unsigned char *src, uint8_t &r, uint8_t &g, uint8_t &b) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (BPP == 4) {
+        uint32_t px; memcpy(&px, src, 4);
+        r = px & 0xff; g = (px >> 8) & 0xff; b = (px >> 16) & 0xff;
+        return;
+    }
+#endif
+    r = src[0]; g = src[1]; b = src[2];
+}
+
+// One readback pixel through the tone curve (TONE) or as is.
+template<int BPP, bool TONE>
+static inline void load_output_pixel(const unsigned char *src, uint8_t &r, uint8_t &g, uint8_t &b) {
+    load_pixel<BPP>(src, r, g, b);
+    if (TONE) { r = lut_tone[0][r]; g = lut_tone[1][g]; b = lut_tone[2][b]; }
+}
+
+// Copies readback columns [x0, x1) of every row into the canvas.
+template<int BPP, bool TONE>
+static void blit_columns(const unsigned char *buffer, FrameCanvas *canvas, int x0, int x1) {
+    uint8_t r, g, b;
+    if (lut_identity) {
+        // Readback is already in LED order: plain row transfer
+        for (int y = 0; y < H; y++) {
+            const unsigned char *src = buffer + ((size_t)y * W + x0) * BPP;
+            for (int x = x0; x < x1; x++, src += BPP) {
+                load_output_pixel<BPP, TONE>(src, r, g, b);
+                canvas->SetPixel(x, y, r, g, b);
+            }
+        }
+        return;
+    }
+    for (int gl_y = 0; gl_y < H; gl_y++) {
+        const unsigned char *src = buffer + ((size_t)gl_y * W + x0) * BPP;
+        const int my = lut_dst_y[gl_y];
+        for (int x = x0; x < x1; x++, src += BPP) {
+            load_output_pixel<BPP, TONE>(src, r, g, b);
+            canvas->SetPixel(lut_dst_x[x], my, r, g, b);
+        }
+    }
+}
+
+/**
+ * Output tiles: with a pool, blit_to_canvas() hands one panel's column range
+ * to each worker. SetPixel() does a read-modify-write on bit-plane words
+ * that rows sharing a scan line (and parallel chains) have in common, but a
+ * word never spans two columns. lut_dst_x is a column permutation, so column
+ * tiles never touch the same word. Pixel mappers can move pixels across
+ * columns, so main() only enables tiles when none is configured.
+ */
+static WorkerPool *g_blitPool = nullptr;
+
+// Copies one tightly packed GL_RGB (bpp 3) or GL_RGBA (bpp 4) readback frame into the canvas via the LUT.
+static void blit_to_canvas(const unsigned char *buffer, FrameCanvas *canvas, int bpp) {
+    auto tile = [&](int x0, int x1) {
+        if (tone_identity) {
+            if (bpp == 4) blit_columns<4, false>(buffer, canvas, x0, x1);
+            else blit_columns<3, false>(buffer, canvas, x0, x1);
+        } else {
+            if (bpp == 4) blit_columns<4, true>(buffer, canvas, x0, x1);
+            else blit_columns<3, true>(buffer, canvas, x0, x1);
+        }
+    };
+    if (!g_blitPool) { tile(0, W); return; }
+    g_blitPool->run(NUM_PANELS, [&](int p) { tile(p * PANEL_W, (p + 1) * PANEL_W); });
+}
+
+// =======================================================
+// SURFACE GEOMETRY (3 cube faces as 64px strips)
+// =======================================================
+/**
+ * Logical layout of the three cube faces, one strip per panel: NDC column
+ * edges and texture coordinates. Vertex order per strip: bottom-left,
+ * top-left, bottom-right, top-right.
+ */
+static const GLfloat strip_edges[NUM_PANELS + 1] = { -1.0f, -0.33f, 0.33f, 1.0f };
+static const GLfloat strip_coords[NUM_PANELS][4][2] = {
+    { {-0.866f, -0.5f}, {-0.866f,  0.5f}, { 0.0f,  -1.0f}, {0.0f,   0.0f} },
+    { { 0.0f,   -1.0f}, { 0.866f, -0.5f}, { 0.0f,   0.0f}, {0.866f, 0.5f} },
+    { { 0.0f,    0.0f}, { 0.866f,  0.5f}, {-0.866f, 0.5f}, {0.0f,   1.0f} },
+};
+
+/**
+ * Builds the triangle strip that covers the pbuffer with the three faces.
+ *
+ * Without GPU remapping each face occupies its logical 64px column range and
+ * the CPU LUT handles orientation. With GPU remapping the panel-0 mirror,
+ * MAP_FLIP_X/MAP_FLIP_Y/MAP_REVERSE_PANELS and the GL bottom-left flip are
+ * expressed as vertex positions instead: each face is placed (and mirrored
+ * if needed) at the columns map_xy() sends it to, with the logical top edge
+ * at GL row 0. glReadPixels then returns rows in matrix order.
+ *
+ * Faces are joined with degenerate triangles, so a remapped layout with
+ * mirrored or reordered faces still renders in a single draw call.
+ */
+static void build_strip_geometry(bool gpu_remap, std::vector<GLfloat> &verts, std::vector<GLfloat> &coords) {
+    // NDC <-> pixel edge
+    auto ndc_x = [](float edge) { return (GLfloat)(edge * 2.0f / W - 1.0f); };
+    auto ndc_y = [](float edge) { return (GLfloat)(edge * 2.0f / H - 1.0f); };
+    auto px_x  = [](GLfloat ndc) { return (ndc + 1.0f) * 0.5f * W; };
+
+    GLfloat yTop = 1.0f, yBottom = -1.0f;
+    if (gpu_remap) {
+        yTop    = MAP_FLIP_Y ? ndc_y(H) : ndc_y(0);
+        yBottom = MAP_FLIP_Y ? ndc_y(0) : ndc_y(H);
+    }
+
+    verts.clear(); coords.clear();
+    for (int p = 0; p < NUM_PANELS; p++) {
+        GLfloat xl = strip_edges[p], xr = strip_edges[p + 1];
+        if (gpu_remap) {
+            // Move (and mirror if needed) the face onto the columns map_xy() sends it to
+            int x0 = p * PANEL_W, ml, mr, my;
+            map_xy(x0, 0, ml, my); map_xy(x0 + PANEL_W - 1, 0, mr, my);
+            auto remap = [&](GLfloat ndc) {
+                float local = px_x(ndc) - x0;
+                return ndc_x((ml <= mr) ? ml + local : ml + 1 - local);
+            };
+            xl = remap(xl); xr = remap(xr);
+        }
+        const GLfloat pos[4][2] = { {xl, yBottom}, {xl, yTop}, {xr, yBottom}, {xr, yTop} };
+        auto push = [&](int v) {
+            verts.push_back(pos[v][0]); verts.push_back(pos[v][1]); verts.push_back(0.0f);
+            coords.push_back(strip_coords[p][v][0]); coords.push_back(strip_coords[p][v][1]);
+        };
+        if (p > 0) {
+            // Degenerate join: repeat the previous strip's last and this strip's first vertex
+            std::vector<GLfloat> lastV(verts.end() - 3, verts.end()), lastC(coords.end() - 2, coords.end());
+            verts.insert(verts.end(), lastV.begin(), lastV.end());
+            coords.insert(coords.end(), lastC.begin(), lastC.end());
+            push(0);
+        }
+        for (int v = 0; v < 4; v++) push(v);
+    }
+}
+
 // =======================================================
 // GLOBAL STATE & THREAD SAFETY
 // =======================================================
-float colourLevel = 30.f;
-float segment[SEGMENTS];
-int geometryMode = 0; // 0:ring, 1:circle, 2:square, 3:triangle, 4:x
-
-float tcolourLevel = 30.f;
-float tsegment[SEGMENTS];
-int tgeometryMode = 0;
-std::string tgeomStr = "ring";
-
-// New (custom) controls
-float elementColorRGB[3] = {1.0f, 1.0f, 1.0f};      // geometry color (in front)
-float backgroundColorRGB[3] = {0.0f, 0.0f, 1.0f};   // background tint
-float telementColorRGB[3] = {1.0f, 1.0f, 1.0f};
-float tbackgroundColorRGB[3] = {0.0f, 0.0f, 1.0f};
-bool  haveElementColor = false;
-bool  haveBackgroundColor = false;
-bool  thaveElementColor = false;
-bool  thaveBackgroundColor = false;
-
-float elementWidth = 20.0f;   // 0..100 thickness
-float percent = 1.0f;         // 0..1 arc coverage
-float telementWidth = 20.0f;
-float tpercent = 1.0f;
-
-std::string modeStr = "heat";   // "heat" or "custom"
-std::string tmodeStr = "heat";
+/**
+ * Visual state shared between the REST API and the render loop.
+ *
+ * The API owns the *target* state (g_target, guarded by target_mtx). Every
+ * accepted update is merged into it field by field and flags it as staged;
+ * the render loop takes a copy at most once per frame, with a try_lock, so
+ * a burst of updates between two frames costs one copy and the last value
+ * of each field wins. The render loop chases that target with its own *live*
+ * copy and publishes it (plus the signal age) through a triple buffer for
+ * GET /status. Neither direction can stall the render thread: if a writer
+ * holds the lock it picks the target up a frame later, and a slow client,
+ * parse or log call only delays other API threads.
+ */
+static const char *const GEOM_NAMES[] = { "ring", "circle", "square", "triangle", "x" };
+static const int NUM_GEOMETRIES = sizeof(GEOM_NAMES) / sizeof(GEOM_NAMES[0]);
 
+// arcMask() draws the whole shape from this percent on (no seam at the join)
+static const float FULL_ARC_PERCENT = 0.99f;
+
+/**
+ * Extra element layered in front of the primary geometry ("elements" in
+ * POST /update), drawn in list order in the same pass. radius is 0..100
+ * with 50 the size of the primary element.
+ */
+static const int MAX_LAYERS = 4;
+
+struct Layer {
+    int   geometryMode = 0;
+    float radius = 50.0f;                                  // 0..100
+    float width = 20.0f;                                   // 0..100 thickness
+    float percent = 1.0f;                                  // 0..1 arc coverage
+    float colorRGB[3] = {1.0f, 1.0f, 1.0f};
+};
+
+struct VisualState {
+    float colourLevel = 30.f;
+    float segment[MAX_SEGMENTS] = {};
+    int   geometryMode = 0;                                // 0:ring, 1:circle, 2:square, 3:triangle, 4:x
+
+    // New (custom) controls
+    float elementColorRGB[3] = {1.0f, 1.0f, 1.0f};         // geometry color (in front)
+    float backgroundColorRGB[3] = {0.0f, 0.0f, 1.0f};      // background tint
+    bool  haveElementColor = false;
+    bool  haveBackgroundColor = false;
+
+    float elementWidth = 20.0f;                            // 0..100 thickness
+    float percent = 1.0f;                                  // 0..1 arc coverage
+
+    char  mode[16] = "heat";                               // "heat" or "custom"
+
+    Layer layer[MAX_LAYERS];
+    int   nlayers = 0;
+
+    uint32_t generation = 0;                               // bumped by every accepted update
+
+    bool is_heat() const { return strcmp(mode, "heat") == 0; }
+    const char *geom_name() const { return GEOM_NAMES[geometryMode]; }
+};
+
+// What GET /status reports: the interpolated live state and the signal age.
+struct LiveStatus {
+    VisualState state;
+    float age = 0.0f;
+    bool timeline = false;      // a POST /timeline is playing
+};
+
+/**
+ * Wait-free single-producer / single-consumer triple buffer.
+ *
+ * The writer fills back() and publish()es it; the reader's read() returns the
+ * newest published value, which stays stable until its next read(). Each side
+ * owns one buffer and they exchange through a third one with a single atomic
+ * swap, so neither side ever waits for the other.
+ */
+template<class T>
+class TripleBuffer {
+public:
+    T &back() { return buf_[back_]; }
+
+    void publish() {
+        back_ = mid_.exchange(back_ | DIRTY, std::memory_order_acq_rel) & INDEX;
+    }
+
+    const T &read() {
+        if (mid_.load(std::memory_order_relaxed) & DIRTY)
+            front_ = mid_.exchange(front_, std::memory_order_acq_rel) & INDEX;
+        return buf_[front_];
+    }
+
+private:
+    static const uint8_t DIRTY = 0x4, INDEX = 0x3;
+    T buf_[3];
+    uint8_t back_ = 0, front_ = 1;
+    std::atomic<uint8_t> mid_{2};
+};
+
+static VisualState g_target;                    // API-owned master copy
+static std::mutex target_mtx;                   // serializes API writers; the render loop only try_locks it
+static std::atomic<bool> g_targetStaged{false}; // g_target changed since the render loop took it
+
+static TripleBuffer<LiveConfig> g_liveConfigBuf;   // API -> render loop
+static std::mutex config_mtx;                   // serializes POST /config writers
+
+static TripleBuffer<LiveStatus> g_liveBuf;      // render loop -> GET /status
+static std::mutex live_read_mtx;                // serializes status snapshot builds (single-consumer side)
+
+// Fleet sync: the animation clock at a point in time (see FLEET SYNC)
+struct SyncClock {
+    float clock = 0.0f;                         // t
+    std::chrono::steady_clock::time_point at;   // when it had that value
+    uint32_t seq = 0;                           // 0: never published
+};
+static TripleBuffer<SyncClock> g_localClockBuf;    // render loop -> sync leader
+static TripleBuffer<SyncClock> g_leaderClockBuf;   // sync follower -> render loop
+
+// Wakes the sync leader when the target changes, so a push goes out at once
+static std::mutex sync_mtx;
+static std::condition_variable sync_cv;
+static bool sync_dirty = false;
+
+static void sync_notify() {
+    {
+        std::lock_guard<std::mutex> lk(sync_mtx);
+        sync_dirty = true;
+    }
+    sync_cv.notify_one();
+}
+
+// Render-thread clock; updateTime is the value of t when the last update was seen
 float t = 0.f;
 float updateTime = -10.0f;
 volatile bool interrupt_received = false;
 
-static std::mutex state_mtx;
 static httplib::Server *g_server = nullptr;
 static auto start_time = std::chrono::steady_clock::now();
 
+// Startup phases in the order main() passes them. The API is up from PHASE_RENDERER
+// on and buffers updates into the target state until the render loop starts.
+enum StartPhase { PHASE_STARTING, PHASE_RENDERER, PHASE_MATRIX, PHASE_SETUP, PHASE_RENDERING, PHASE_STOPPING };
+static const char *const START_PHASE_NAMES[] = {"starting", "renderer", "matrix", "setup", "rendering", "stopping"};
+static std::atomic<int> g_startPhase{PHASE_STARTING};
+// Milliseconds since start when the API listened and rendering began, and how long
+// the renderer and matrix init (which run in parallel) took; -1 until known
+static std::atomic<int> g_apiUpMs{-1}, g_rendererMs{-1}, g_matrixMs{-1}, g_readyMs{-1};
+
+static int ms_since(std::chrono::steady_clock::time_point t0) {
+    return (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+}
+
 // =======================================================
 // UTILITIES (Logging & Formatting)
 // =======================================================
@@ -234,19 +904,6 @@ namespace std {
     }
 }
 
-static std::string now_hms() {
-    auto now = std::chrono::system_clock::now();
-    std::time_t tt = std::chrono::system_clock::to_time_t(now);
-    std::tm tm{}; localtime_r(&tt, &tm);
-    char buf[32]; strftime(buf, sizeof(buf), "%H:%M:%S", &tm);
-    return std::string(buf);
-}
-
-static void log_ts(const std::string &msg) {
-    fprintf(stderr, "[%s] %s\n", now_hms().c_str(), msg.c_str());
-    fflush(stderr);
-}
-
 static std::string fmt_float(float v, int prec=3) {
     std::ostringstream ss; ss << std::fixed << std::setprecision(prec) << v;
     return ss.str();
@@ -254,89 +911,403 @@ static std::string fmt_float(float v, int prec=3) {
 
 static std::string segments_to_string(const float seg[]) {
     std::ostringstream ss; ss << "[";
-    for (int i = 0; i < SEGMENTS; i++) {
+    for (int i = 0; i < g_cfg.segments; i++) {
         ss << fmt_float(seg[i], 2);
-        if (i < SEGMENTS - 1) ss << ",";
+        if (i < g_cfg.segments - 1) ss << ",";
     }
     ss << "]"; return ss.str();
 }
 
+// Escapes a string for embedding between quotes in a JSON response
+static std::string json_escape(const char *s) {
+    std::string out;
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') { out += '\\'; out += (char)c; }
+        else if (c < 0x20) { char u[8]; snprintf(u, sizeof(u), "\\u%04x", c); out += u; }
+        else out += (char)c;
+    }
+    return out;
+}
+
+// 32-bit FNV-1a (UDP token check, status ETag)
+static uint32_t fnv1a32(const char *s, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++) { h ^= (unsigned char)s[i]; h *= 16777619u; }
+    return h;
+}
+
+/**
+ * log_ts() hands the line to a lock-free ring that a background thread
+ * drains to stderr, so a caller pays for two clock reads and a memcpy and
+ * never blocks on I/O (a write to journald can stall for milliseconds).
+ * Producers claim a slot with one CAS (bounded MPMC queue, one sequence
+ * number per slot); when the ring is full the line is dropped and counted
+ * rather than waited for.
+ *
+ * Each category (the "API:" style prefix) is limited to log-rate lines per
+ * second with bursts of LOG_BURST (GCRA on one atomic per category). The
+ * next line of a category that gets through reports how many were
+ * suppressed. log-format=json writes one JSON object per line. Lines logged
+ * before start() or still queued at exit are written by stop().
+ */
+static const char *const LOG_CATEGORIES[] = { "INIT", "RENDER", "GL", "API", "UDP", "STREAM", "SYNC",
+                                              "CAPTURE", "GOVERNOR", "THERMAL", "STATS", "BENCH", "SIGNAL", "EXIT" };
+static const int LOG_NUM_CATEGORIES = sizeof(LOG_CATEGORIES) / sizeof(LOG_CATEGORIES[0]) + 1;   // + uncategorized
+static const int LOG_SLOTS = 256;               // power of two
+static const size_t LOG_TEXT_MAX = 1000;        // longer lines (shader logs) are cut
+static const int LOG_BURST = 30;
+static const int LOG_DRAIN_MS = 20;
+
+class Logger {
+public:
+    Logger() {
+        for (int i = 0; i < LOG_SLOTS; i++) slot_[i].seq.store(i, std::memory_order_relaxed);
+        for (int c = 0; c < LOG_NUM_CATEGORIES; c++) { tat_[c] = 0; suppressedNow_[c] = 0; }
+    }
+    ~Logger() { stop(); }
+
+    // ratePerSec 0: no rate limit
+    void configure(bool json, int ratePerSec) {
+        json_ = json;
+        rate_ = ratePerSec;
+    }
+
+    void start() { drainer_ = std::thread([this] { drain_loop(); }); }
+
+    void stop() {
+        if (drainer_.joinable()) {
+            stop_ = true;
+            drainer_.join();
+        }
+        drain();
+    }
+
+    // Any thread; never blocks
+    void log(const char *msg, size_t len) {
+        const int cat = category(msg, len);
+        timespec mono;
+        clock_gettime(CLOCK_MONOTONIC, &mono);
+        if (!allow(cat, (int64_t)mono.tv_sec * 1000000 + mono.tv_nsec / 1000)) {
+            suppressedNow_[cat]++;
+            suppressed_++;
+            return;
+        }
+
+        uint32_t pos = enqueue_.load(std::memory_order_relaxed);
+        Slot *s;
+        for (;;) {
+            s = &slot_[pos & (LOG_SLOTS - 1)];
+            int32_t dif = (int32_t)(s->seq.load(std::memory_order_acquire) - pos);
+            if (dif == 0 && enqueue_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            if (dif < 0) { dropped_++; return; }    // full
+            if (dif > 0) pos = enqueue_.load(std::memory_order_relaxed);
+        }
+        timespec wall;
+        clock_gettime(CLOCK_REALTIME, &wall);
+        s->unixMs = (int64_t)wall.tv_sec * 1000 + wall.tv_nsec / 1000000;
+        s->cat = (uint8_t)cat;
+        s->suppressed = suppressedNow_[cat].exchange(0);
+        s->len = (uint16_t)std::min(len, LOG_TEXT_MAX);
+        memcpy(s->text, msg, s->len);
+        s->seq.store(pos + 1, std::memory_order_release);
+    }
+
+    uint64_t written() const { return written_; }
+    uint64_t suppressed() const { return suppressed_; }
+    uint64_t dropped() const { return dropped_; }
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> seq;
+        uint8_t  cat;
+        uint16_t len;
+        uint32_t suppressed;        // lines of this category dropped by the limit before this one
+        int64_t  unixMs;
+        char     text[LOG_TEXT_MAX];
+    };
+
+    static int category(const char *msg, size_t len) {
+        size_t n = 0;
+        while (n < len && n < 12 && msg[n] >= 'A' && msg[n] <= 'Z') n++;
+        for (int c = 0; c < LOG_NUM_CATEGORIES - 1; c++)
+            if (strlen(LOG_CATEGORIES[c]) == n && memcmp(LOG_CATEGORIES[c], msg, n) == 0) return c;
+        return LOG_NUM_CATEGORIES - 1;
+    }
+
+    // Generic cell rate algorithm: tat_ is the time the bucket would be empty again
+    bool allow(int cat, int64_t nowUs) {
+        const int rate = rate_.load(std::memory_order_relaxed);
+        if (rate <= 0) return true;
+        const int64_t interval = 1000000 / rate, limit = interval * (LOG_BURST - 1);
+        int64_t tat = tat_[cat].load(std::memory_order_relaxed);
+        for (;;) {
+            const int64_t base = std::max(tat, nowUs);
+            if (base - nowUs > limit) return false;
+            if (tat_[cat].compare_exchange_weak(tat, base + interval, std::memory_order_relaxed)) return true;
+        }
+    }
+
+    void drain_loop() {
+        while (!stop_) {
+            if (!drain()) std::this_thread::sleep_for(std::chrono::milliseconds(LOG_DRAIN_MS));
+        }
+    }
+
+    // Writes every queued line with one write; false if there was none
+    bool drain() {
+        out_.clear();
+        for (;;) {
+            Slot &s = slot_[dequeue_ & (LOG_SLOTS - 1)];
+            if (s.seq.load(std::memory_order_acquire) != dequeue_ + 1) break;
+            format(s);
+            s.seq.store(dequeue_ + LOG_SLOTS, std::memory_order_release);
+            dequeue_++;
+            written_++;
+        }
+        if (out_.empty()) return false;
+        fwrite(out_.data(), 1, out_.size(), stderr);
+        fflush(stderr);
+        return true;
+    }
+
+    void format(const Slot &s) {
+        const std::string text(s.text, s.len);
+        std::time_t tt = (std::time_t)(s.unixMs / 1000);
+        std::tm tm{};
+        char buf[48];
+        if (json_) {
+            gmtime_r(&tt, &tm);
+            strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+            // The category goes to its own field, the message without its prefix
+            size_t skip = 0;
+            if (s.cat < LOG_NUM_CATEGORIES - 1) {
+                skip = strlen(LOG_CATEGORIES[s.cat]);
+                if (skip < text.size() && text[skip] == ':') skip++;
+                while (skip < text.size() && text[skip] == ' ') skip++;
+            }
+            char ms[8];
+            snprintf(ms, sizeof(ms), ".%03dZ", (int)(s.unixMs % 1000));
+            out_ += std::string("{\"ts\":\"") + buf + ms + "\",\"cat\":\""
+                  + (s.cat < LOG_NUM_CATEGORIES - 1 ? LOG_CATEGORIES[s.cat] : "") + "\",\"msg\":\""
+                  + json_escape(text.c_str() + skip) + "\"";
+            if (s.suppressed) out_ += ",\"suppressed\":" + std::to_string(s.suppressed);
+            out_ += "}\n";
+        } else {
+            localtime_r(&tt, &tm);
+            strftime(buf, sizeof(buf), "%H:%M:%S", &tm);
+            out_ += std::string("[") + buf + "] " + text;
+            if (s.suppressed) out_ += " (+" + std::to_string(s.suppressed) + " suppressed)";
+            out_ += "\n";
+        }
+    }
+
+    Slot slot_[LOG_SLOTS];
+    std::atomic<uint32_t> enqueue_{0};
+    uint32_t dequeue_ = 0;                   // drainer (or stop()) only
+    std::atomic<int64_t> tat_[LOG_NUM_CATEGORIES];
+    std::atomic<uint32_t> suppressedNow_[LOG_NUM_CATEGORIES];
+    std::atomic<bool> json_{false}, stop_{false};
+    std::atomic<int> rate_{0};
+    std::atomic<uint64_t> written_{0}, suppressed_{0}, dropped_{0};
+    std::string out_;
+    std::thread drainer_;
+};
+
+static Logger g_log;
+
+static void log_ts(const std::string &msg) {
+    g_log.log(msg.data(), msg.size());
+}
+
 static void InterruptHandler(int signo) {
     (void)signo; interrupt_received = true;
     log_ts("SIGNAL: interrupt received");
     if (g_server) g_server->stop();
 }
 
-// ---- Minimal JSON helpers (no external deps; keeps original structure) ----
+// ---- Minimal JSON parsing for POST /update (no external deps, no heap) ----
 
-static inline void skip_ws(const std::string &s, size_t &i) {
-    while (i < s.size() && (s[i] == ' ' || s[i] == '\n' || s[i] == '\r' || s[i] == '\t')) i++;
-}
+/**
+ * Fields of one /update request. `present` has a bit per key that appeared
+ * in the body, so applying a request only touches what the client sent;
+ * unknown keys are skipped whatever their type.
+ */
+struct UpdateFields {
+    enum : uint32_t {
+        F_MODE             = 1u << 0,
+        F_COLOUR           = 1u << 1,
+        F_GEOMETRY         = 1u << 2,
+        F_SEGMENTS         = 1u << 3,
+        F_WIDTH            = 1u << 4,
+        F_PERCENT          = 1u << 5,
+        F_ELEMENT_COLOR    = 1u << 6,   // only set for a valid "#RRGGBB"
+        F_BACKGROUND_COLOR = 1u << 7,   // only set for a valid "#RRGGBB"
+        F_ELEMENTS         = 1u << 8,
+    };
+    uint32_t present = 0;
 
-static bool extract_json_string(const std::string &body, const std::string &key, std::string &out) {
-    size_t k = body.find("\"" + key + "\"");
-    if (k == std::string::npos) return false;
-    size_t colon = body.find(':', k);
-    if (colon == std::string::npos) return false;
-    size_t i = colon + 1;
-    skip_ws(body, i);
-    if (i >= body.size() || body[i] != '"') return false;
-    i++;
-    size_t j = i;
-    while (j < body.size() && body[j] != '"') j++;
-    if (j >= body.size()) return false;
-    out = body.substr(i, j - i);
-    return true;
-}
+    char  mode[16] = "";
+    float colour = 0.0f;
+    int   geometryMode = -1;            // -1: unknown name (accepted, ignored)
+    float segment[MAX_SEGMENTS];
+    int   nseg = 0;                     // leading entries of segment[] that were sent
+    float width = 0.0f;
+    float percent = 0.0f;
+    float elementColorRGB[3];
+    float backgroundColorRGB[3];
+    Layer layer[MAX_LAYERS];
+    int   nlayers = 0;                  // leading entries of layer[] that were sent
 
-static bool extract_json_number(const std::string &body, const std::string &key, float &out) {
-    size_t k = body.find("\"" + key + "\"");
-    if (k == std::string::npos) return false;
-    size_t colon = body.find(':', k);
-    if (colon == std::string::npos) return false;
-    size_t i = colon + 1;
-    skip_ws(body, i);
-    // read until comma or end brace
-    size_t j = i;
-    while (j < body.size() && body[j] != ',' && body[j] != '}' && body[j] != ']' && body[j] != '\n' && body[j] != '\r') j++;
-    try {
-        out = std::stof(body.substr(i, j - i));
-        return true;
-    } catch (...) {
+    bool has(uint32_t f) const { return (present & f) != 0; }
+};
+
+/**
+ * Single-pass cursor over a JSON text. Strings are decoded (escapes
+ * included) into caller-provided fixed buffers, truncating on overflow;
+ * values the caller doesn't want are validated and skipped, nesting
+ * included, down to MAX_DEPTH.
+ */
+class JsonCursor {
+public:
+    JsonCursor(const char *p, size_t n) : p_(p), end_(p + n) {}
+
+    void ws() { while (p_ < end_ && (*p_ == ' ' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t')) p_++; }
+    bool done() { ws(); return p_ == end_; }
+    bool peek(char c) { ws(); return p_ < end_ && *p_ == c; }
+    bool eat(char c) { if (!peek(c)) return false; p_++; return true; }
+
+    /** Decodes a string into out (NUL-terminated); truncated is set if it didn't fit. */
+    bool string(char *out, size_t cap, bool &truncated) {
+        truncated = false;
+        if (!eat('"')) return false;
+        size_t n = 0;
+        while (p_ < end_) {
+            unsigned char c = (unsigned char)*p_++;
+            if (c == '"') { if (out) out[n] = '\0'; return true; }
+            if (c < 0x20) return false;
+            uint32_t cp = c;
+            if (c == '\\') {
+                if (p_ >= end_) return false;
+                switch (*p_++) {
+                    case '"':  cp = '"';  break;
+                    case '\\': cp = '\\'; break;
+                    case '/':  cp = '/';  break;
+                    case 'b':  cp = '\b'; break;
+                    case 'f':  cp = '\f'; break;
+                    case 'n':  cp = '\n'; break;
+                    case 'r':  cp = '\r'; break;
+                    case 't':  cp = '\t'; break;
+                    case 'u':  if (!hex4(cp)) return false; break;
+                    default:   return false;
+                }
+            }
+            if (!out) continue;
+            // Raw bytes pass through; \u escapes are re-encoded as UTF-8 (surrogates kept as-is)
+            char enc[3]; size_t len = 1;
+            if (cp < 0x80 || c != '\\') enc[0] = (char)cp;
+            else if (cp < 0x800) { enc[0] = (char)(0xC0 | (cp >> 6)); enc[1] = (char)(0x80 | (cp & 0x3F)); len = 2; }
+            else { enc[0] = (char)(0xE0 | (cp >> 12)); enc[1] = (char)(0x80 | ((cp >> 6) & 0x3F)); enc[2] = (char)(0x80 | (cp & 0x3F)); len = 3; }
+            if (n + len >= cap) { truncated = true; continue; }
+            memcpy(out + n, enc, len); n += len;
+        }
         return false;
     }
-}
 
-static bool extract_json_array_floats(const std::string &body, const std::string &key, float *outArr, int maxN, int &outN) {
-    outN = 0;
-    size_t k = body.find("\"" + key + "\"");
-    if (k == std::string::npos) return false;
-    size_t lb = body.find('[', k);
-    size_t rb = body.find(']', k);
-    if (lb == std::string::npos || rb == std::string::npos || rb <= lb) return false;
-    std::stringstream ss(body.substr(lb + 1, rb - lb - 1));
-    std::string val;
-    int idx = 0;
-    try {
-        while (std::getline(ss, val, ',') && idx < maxN) {
-            // trim
-            val.erase(val.begin(), std::find_if(val.begin(), val.end(), [](unsigned char ch){ return !std::isspace(ch); }));
-            val.erase(std::find_if(val.rbegin(), val.rend(), [](unsigned char ch){ return !std::isspace(ch); }).base(), val.end());
-            if (val.empty()) continue;
-            outArr[idx++] = std::stof(val);
-        }
-    } catch (...) {
+    /** Parses a JSON number (strict grammar: no hex, inf, nan or leading '+'). */
+    bool number(float &out) {
+        ws();
+        const char *s = p_, *q = p_;
+        if (q < end_ && *q == '-') q++;
+        if (q >= end_ || !isdigit((unsigned char)*q)) return false;
+        if (*q == '0') q++; else while (q < end_ && isdigit((unsigned char)*q)) q++;
+        if (q < end_ && *q == '.') {
+            q++;
+            if (q >= end_ || !isdigit((unsigned char)*q)) return false;
+            while (q < end_ && isdigit((unsigned char)*q)) q++;
+        }
+        if (q < end_ && (*q == 'e' || *q == 'E')) {
+            q++;
+            if (q < end_ && (*q == '+' || *q == '-')) q++;
+            if (q >= end_ || !isdigit((unsigned char)*q)) return false;
+            while (q < end_ && isdigit((unsigned char)*q)) q++;
+        }
+        char tmp[48];
+        size_t len = (size_t)(q - s);
+        if (len >= sizeof(tmp)) return false;
+        memcpy(tmp, s, len); tmp[len] = '\0';
+        out = strtof(tmp, nullptr);
+        p_ = q;
+        return true;
+    }
+
+    bool boolean(bool &out) {
+        ws();
+        if (literal("true")) { out = true; return true; }
+        if (literal("false")) { out = false; return true; }
         return false;
     }
-    outN = idx;
-    return true;
-}
 
-static bool parse_hex_color(const std::string &hex, float rgb[3]) {
+    /** Validates and skips any value. */
+    bool skip(int depth = 0) {
+        if (depth > MAX_DEPTH) return false;
+        bool trunc; float f;
+        ws();
+        if (p_ >= end_) return false;
+        switch (*p_) {
+            case '"': return string(nullptr, 0, trunc);
+            case '{':
+                p_++;
+                if (eat('}')) return true;
+                do {
+                    if (!string(nullptr, 0, trunc) || !eat(':') || !skip(depth + 1)) return false;
+                } while (eat(','));
+                return eat('}');
+            case '[':
+                p_++;
+                if (eat(']')) return true;
+                do { if (!skip(depth + 1)) return false; } while (eat(','));
+                return eat(']');
+            case 't': return literal("true");
+            case 'f': return literal("false");
+            case 'n': return literal("null");
+            default:  return number(f);
+        }
+    }
+
+private:
+    static const int MAX_DEPTH = 16;
+
+    bool hex4(uint32_t &cp) {
+        if (end_ - p_ < 4) return false;
+        cp = 0;
+        for (int i = 0; i < 4; i++) {
+            char c = *p_++;
+            cp <<= 4;
+            if (c >= '0' && c <= '9') cp |= (uint32_t)(c - '0');
+            else if (c >= 'a' && c <= 'f') cp |= (uint32_t)(10 + c - 'a');
+            else if (c >= 'A' && c <= 'F') cp |= (uint32_t)(10 + c - 'A');
+            else return false;
+        }
+        return true;
+    }
+
+    bool literal(const char *lit) {
+        size_t n = strlen(lit);
+        if ((size_t)(end_ - p_) < n || memcmp(p_, lit, n) != 0) return false;
+        p_ += n;
+        return true;
+    }
+
+    const char *p_;
+    const char *end_;
+};
+
+static bool parse_hex_color(const char *hex, float rgb[3]) {
     // supports "#RRGGBB" or "RRGGBB"
-    std::string h = hex;
-    if (!h.empty() && h[0] == '#') h = h.substr(1);
-    if (h.size() != 6) return false;
+    const char *h = hex;
+    if (h[0] == '#') h++;
+    if (strlen(h) != 6) return false;
     auto hex2 = [](char c)->int {
         if (c >= '0' && c <= '9') return c - '0';
         if (c >= 'a' && c <= 'f') return 10 + (c - 'a');
@@ -356,13 +1327,157 @@ static bool parse_hex_color(const std::string &hex, float rgb[3]) {
     return true;
 }
 
+enum FieldResult { FIELD_OK, FIELD_UNKNOWN, FIELD_INVALID };
+
+static int geometry_index(const char *name) {
+    for (int g = 0; g < NUM_GEOMETRIES; g++)
+        if (!strcmp(name, GEOM_NAMES[g])) return g;
+    return -1;
+}
+
 /**
- * Maps a numerical input (0.0 - 100.0) to a specific background color gradient.
- * * The gradient follows a three-stage transition designed for the "heat" aesthetic:
- * 1. COLD (0-33): Deep Blue transitioning into Teal/Turquoise. This recreates 
- * the "magic shine" effect from the original shader by increasing the green channel.
- * 2. MEDIUM (33-66): Teal transitioning into Yellow.
- * 3. HOT (66-100): Yellow transitioning into pure Red.
+ * One "elements" entry: { "geometry", "radius", "width", "percent",
+ * "color" }. Missing keys keep the Layer defaults, an unknown geometry
+ * draws a ring and an invalid colour stays white.
+ */
+static bool parse_layer(JsonCursor &c, Layer &l) {
+    if (!c.eat('{')) return false;
+    if (c.eat('}')) return true;
+    char key[24], str[24];
+    bool trunc;
+    do {
+        if (!c.string(key, sizeof(key), trunc) || !c.eat(':')) return false;
+        if (trunc) key[0] = '\0';
+        bool ok;
+        if (!strcmp(key, "geometry")) {
+            ok = c.string(str, sizeof(str), trunc);
+            int g = trunc ? -1 : geometry_index(str);
+            if (g >= 0) l.geometryMode = g;
+        } else if (!strcmp(key, "radius")) {
+            ok = c.number(l.radius);
+        } else if (!strcmp(key, "width")) {
+            ok = c.number(l.width);
+        } else if (!strcmp(key, "percent")) {
+            ok = c.number(l.percent);
+        } else if (!strcmp(key, "color")) {
+            ok = c.string(str, sizeof(str), trunc);
+            float rgb[3];
+            if (ok && !trunc && parse_hex_color(str, rgb)) memcpy(l.colorRGB, rgb, sizeof(rgb));
+        } else {
+            ok = c.skip();
+        }
+        if (!ok) return false;
+    } while (c.eat(','));
+    return c.eat('}');
+}
+
+/** Parses the value of one /update key into f; FIELD_UNKNOWN leaves the value unread. */
+static FieldResult parse_update_field(JsonCursor &c, const char *key, UpdateFields &f) {
+    char str[24];
+    bool trunc;
+    if (!strcmp(key, "mode")) {
+        if (!c.string(f.mode, sizeof(f.mode), trunc)) return FIELD_INVALID;
+        f.present |= UpdateFields::F_MODE;
+    } else if (!strcmp(key, "colour")) {
+        if (!c.number(f.colour)) return FIELD_INVALID;
+        f.present |= UpdateFields::F_COLOUR;
+    } else if (!strcmp(key, "geometry")) {
+        if (!c.string(str, sizeof(str), trunc)) return FIELD_INVALID;
+        f.geometryMode = trunc ? -1 : geometry_index(str);
+        f.present |= UpdateFields::F_GEOMETRY;
+    } else if (!strcmp(key, "segments")) {
+        if (!c.eat('[')) return FIELD_INVALID;
+        f.nseg = 0;
+        if (!c.eat(']')) {
+            do {
+                float v;
+                if (!c.number(v)) return FIELD_INVALID;
+                if (f.nseg < g_cfg.segments) f.segment[f.nseg++] = v;   // extra entries are ignored
+            } while (c.eat(','));
+            if (!c.eat(']')) return FIELD_INVALID;
+        }
+        f.present |= UpdateFields::F_SEGMENTS;
+    } else if (!strcmp(key, "width")) {
+        if (!c.number(f.width)) return FIELD_INVALID;
+        f.present |= UpdateFields::F_WIDTH;
+    } else if (!strcmp(key, "percent")) {
+        if (!c.number(f.percent)) return FIELD_INVALID;
+        f.present |= UpdateFields::F_PERCENT;
+    } else if (!strcmp(key, "elementColor") || !strcmp(key, "backgroundColor")) {
+        bool element = key[0] == 'e';
+        if (!c.string(str, sizeof(str), trunc)) return FIELD_INVALID;
+        float *rgb = element ? f.elementColorRGB : f.backgroundColorRGB;
+        if (!trunc && parse_hex_color(str, rgb))
+            f.present |= element ? UpdateFields::F_ELEMENT_COLOR : UpdateFields::F_BACKGROUND_COLOR;
+    } else if (!strcmp(key, "elements")) {
+        if (!c.eat('[')) return FIELD_INVALID;
+        f.nlayers = 0;
+        if (!c.eat(']')) {
+            do {
+                Layer l;
+                if (!parse_layer(c, l)) return FIELD_INVALID;
+                if (f.nlayers < MAX_LAYERS) f.layer[f.nlayers++] = l;   // extra entries are ignored
+            } while (c.eat(','));
+            if (!c.eat(']')) return FIELD_INVALID;
+        }
+        f.present |= UpdateFields::F_ELEMENTS;
+    } else {
+        return FIELD_UNKNOWN;
+    }
+    return FIELD_OK;
+}
+
+/**
+ * Parses an /update body in one pass. The body must be a single JSON object;
+ * anything malformed (including a wrongly typed known key) rejects the whole
+ * request, so a bad payload never half-applies.
+ */
+static bool parse_update_json(const char *body, size_t len, UpdateFields &f) {
+    JsonCursor c(body, len);
+    if (!c.eat('{')) return false;
+    if (c.eat('}')) return c.done();
+
+    char key[24];
+    bool trunc;
+    do {
+        if (!c.string(key, sizeof(key), trunc) || !c.eat(':')) return false;
+        if (trunc) key[0] = '\0';       // longer than any key we know
+
+        FieldResult r = parse_update_field(c, key, f);
+        if (r == FIELD_INVALID || (r == FIELD_UNKNOWN && !c.skip())) return false;
+    } while (c.eat(','));
+
+    return c.eat('}') && c.done();
+}
+
+
+/**
+ * Heat palette: colour stops with linear blends between neighbours. Two
+ * stops at one position make a step, like the jump to the brighter teal at
+ * 33 in the default table. heat-palette replaces it.
+ */
+struct PaletteStop {
+    float pos;          // heat level 0..100, non-decreasing
+    float rgb[3];
+};
+static const size_t MAX_PALETTE_STOPS = 16;
+
+// Written once in main() before any other thread starts
+static std::vector<PaletteStop> g_heatPalette = {
+    {   0.0f, { 0.0f, 0.0f, 0.4f } },
+    {  33.0f, { 0.0f, 0.5f, 0.8f } },
+    {  33.0f, { 0.0f, 0.6f, 1.0f } },
+    {  66.0f, { 1.0f, 1.0f, 0.0f } },
+    { 100.0f, { 1.0f, 0.0f, 0.0f } },
+};
+
+/**
+ * Maps a numerical input (0.0 - 100.0) to a specific background color gradient.
+ * * The default gradient follows a three-stage transition designed for the "heat" aesthetic:
+ * 1. COLD (0-33): Deep Blue transitioning into Teal/Turquoise. This recreates 
+ * the "magic shine" effect from the original shader by increasing the green channel.
+ * 2. MEDIUM (33-66): Teal transitioning into Yellow.
+ * 3. HOT (66-100): Yellow transitioning into pure Red.
  *
  * @param colour01_100 The input heat level, clamped between 0.0 and 100.0.
  * @param rgb An output array of 3 floats where the calculated R, G, and B 
@@ -370,26 +1485,311 @@ static bool parse_hex_color(const std::string &hex, float rgb[3]) {
  */
 static void heat_colour_to_bg(float colour01_100, float rgb[3]) {
     float c = compat::clamp(colour01_100, 0.0f, 100.0f);
-    
-    if (c <= 33.0f) {
-        // COLD: Deep Blue -> Teal (Your original favorite)
-        float t = c / 33.0f;
-        rgb[0] = 0.0f;          // No Red
-        rgb[1] = t * 0.5f;          // Green starts at 0 and goes to 0.5
-        rgb[2] = 0.4f + (t * 0.4f); // Blue starts dark (0.4) and brightens
-    } else if (c <= 66.0f) {
-        // MEDIUM: Teal -> Yellow
-        float t = (c - 33.0f) / 33.0f;
-        rgb[0] = t;             // Increasing Red
-        rgb[1] = 0.6f + (t * 0.4f); 
-        rgb[2] = 1.0f - t;      // Decreasing Blue
+    const std::vector<PaletteStop> &p = g_heatPalette;
+
+    // First segment that ends at or after c; levels outside the table clamp
+    size_t i = 1;
+    while (i + 1 < p.size() && c > p[i].pos) i++;
+    const PaletteStop &a = p[i - 1], &b = p[i];
+    float span = b.pos - a.pos;
+    float t = span > 0.0f ? compat::clamp((c - a.pos) / span, 0.0f, 1.0f) : 1.0f;
+    for (int k = 0; k < 3; k++) rgb[k] = a.rgb[k] + (b.rgb[k] - a.rgb[k]) * t;
+}
+
+// "pos:#RRGGBB,pos:#RRGGBB,..." with 2..MAX_PALETTE_STOPS stops in non-decreasing order
+static bool parse_heat_palette(const std::string &v, std::vector<PaletteStop> &out) {
+    out.clear();
+    std::stringstream ss(v);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t colon = item.find(':');
+        if (colon == std::string::npos || out.size() == MAX_PALETTE_STOPS) return false;
+        PaletteStop st;
+        char *end = nullptr;
+        st.pos = strtof(item.c_str(), &end);
+        if (end != item.c_str() + colon || !(st.pos >= 0.0f && st.pos <= 100.0f)) return false;
+        if (!out.empty() && st.pos < out.back().pos) return false;
+        if (!parse_hex_color(item.c_str() + colon + 1, st.rgb)) return false;
+        out.push_back(st);
+    }
+    return out.size() >= 2;
+}
+
+/**
+ * Applies the fields of one parsed /update request to a target state,
+ * including the heat/custom colour rules. Returns false if the request
+ * carried nothing usable.
+ */
+static bool apply_update(const UpdateFields &f, VisualState &ts) {
+    bool any = false;
+
+    // NEW: mode (heat/custom)
+    if (f.has(UpdateFields::F_MODE)) {
+        memcpy(ts.mode, f.mode, sizeof(ts.mode));
+        any = true;
+    }
+
+    // OLD: colour (0..100)
+    if (f.has(UpdateFields::F_COLOUR)) {
+        ts.colourLevel = compat::clamp(f.colour, 0.0f, 100.0f);
+        any = true;
+    }
+
+    // Geometry (old/new); unknown names are accepted but leave it unchanged
+    if (f.has(UpdateFields::F_GEOMETRY)) {
+        if (f.geometryMode >= 0) ts.geometryMode = f.geometryMode;
+        any = true;
+    }
+
+    // Segments (old/new); a short array only updates the leading segments
+    if (f.has(UpdateFields::F_SEGMENTS)) {
+        for (int i = 0; i < f.nseg; i++) ts.segment[i] = compat::clamp(f.segment[i], 0.0f, 100.0f);
+        any = true;
+    }
+
+    // NEW: width (0..100) thickness
+    if (f.has(UpdateFields::F_WIDTH)) {
+        ts.elementWidth = compat::clamp(f.width, 0.0f, 100.0f);
+        any = true;
+    }
+
+    // NEW: percent (0..1) arc coverage
+    if (f.has(UpdateFields::F_PERCENT)) {
+        ts.percent = compat::clamp(f.percent, 0.0f, 1.0f);
+        any = true;
+    }
+
+    // NEW: elementColor
+    if (f.has(UpdateFields::F_ELEMENT_COLOR)) {
+        memcpy(ts.elementColorRGB, f.elementColorRGB, sizeof(ts.elementColorRGB));
+        ts.haveElementColor = true;
+        any = true;
+    }
+
+    // NEW: backgroundColor
+    bool gotBackgroundColor = f.has(UpdateFields::F_BACKGROUND_COLOR);
+    if (gotBackgroundColor) {
+        memcpy(ts.backgroundColorRGB, f.backgroundColorRGB, sizeof(ts.backgroundColorRGB));
+        ts.haveBackgroundColor = true;
+        any = true;
+    }
+
+    // Element layers: the list replaces the previous one ([] removes them all)
+    if (f.has(UpdateFields::F_ELEMENTS)) {
+        ts.nlayers = f.nlayers;
+        for (int i = 0; i < f.nlayers; i++) {
+            Layer &l = ts.layer[i];
+            l = f.layer[i];
+            l.radius = compat::clamp(l.radius, 0.0f, 100.0f);
+            l.width = compat::clamp(l.width, 0.0f, 100.0f);
+            l.percent = compat::clamp(l.percent, 0.0f, 1.0f);
+        }
+        any = true;
+    }
+
+    // Apply requested "heat mode" enforcement:
+    // - geometry forced to ring
+    // - element color forced to white
+    // - background uses translated colourLevel (unless explicit backgroundColor provided)
+    if (ts.is_heat()) {
+        ts.geometryMode = 0;
+        ts.elementColorRGB[0] = 1.0f; ts.elementColorRGB[1] = 1.0f; ts.elementColorRGB[2] = 1.0f;
+        ts.haveElementColor = true;
+
+        // Minimal fix: In heat mode, background MUST follow heat translation unless THIS request explicitly provides backgroundColor.
+        if (!gotBackgroundColor) {
+            heat_colour_to_bg(ts.colourLevel, ts.backgroundColorRGB);
+            ts.haveBackgroundColor = true;
+        }
+
+        // percent/width are optional in heat mode; leave whatever was set.
+    } else {
+        // In custom mode: if legacy colour is present but backgroundColor isn't,
+        // translate colour to backgroundColor (requested).
+        if (!gotBackgroundColor && f.has(UpdateFields::F_COLOUR)) {
+            heat_colour_to_bg(ts.colourLevel, ts.backgroundColorRGB);
+            ts.haveBackgroundColor = true;
+        }
+        // elementColor may or may not be present; if absent, keep previous.
+    }
+
+    return any;
+}
+
+// =======================================================
+// TIMELINE PLAYBACK
+// =======================================================
+/**
+ * Keyframed choreography pushed in one POST /timeline request and played
+ * back by the render loop on its own clock, so animations don't depend on
+ * network round-trips or jitter.
+ *
+ * Keyframes are resolved on the API side: each one is applied on top of the
+ * previous one (the first on top of the current target) with the normal
+ * /update rules, so the render thread only blends complete VisualStates.
+ * Continuous values are eased towards the next keyframe with this
+ * keyframe's `ease`; mode and geometry switch when a keyframe is reached.
+ */
+enum Ease : uint8_t { EASE_LINEAR, EASE_STEP, EASE_IN, EASE_OUT, EASE_IN_OUT, EASE_COUNT };
+static const char *const EASE_NAMES[EASE_COUNT] = { "linear", "step", "in", "out", "in-out" };
+
+static const int MAX_KEYFRAMES = 128;
+static const float MAX_TIMELINE_SEC = 86400.0f;
+
+struct Keyframe {
+    float   t = 0.0f;                   // seconds from playback start
+    uint8_t ease = EASE_LINEAR;         // curve towards the next keyframe
+    VisualState state;
+};
+
+struct Timeline {
+    Keyframe key[MAX_KEYFRAMES];
+    int      count = 0;                 // 0: no timeline, the render loop chases the target
+    bool     loop = false;              // repeat with period key[count-1].t
+    uint32_t generation = 0;
+
+    float duration() const { return count ? key[count - 1].t : 0.0f; }
+};
+
+static TripleBuffer<Timeline> g_timelineBuf;    // API -> render loop (publishers hold target_mtx)
+static uint32_t g_timelineGeneration = 0;       // guarded by target_mtx
+static bool g_timelinePublished = false;        // guarded by target_mtx: a timeline may be playing
+
+static float apply_ease(uint8_t ease, float x) {
+    switch (ease) {
+        case EASE_STEP:   return 0.0f;
+        case EASE_IN:     return x * x;
+        case EASE_OUT:    return x * (2.0f - x);
+        case EASE_IN_OUT: return x * x * (3.0f - 2.0f * x);
+        default:          return x;
+    }
+}
+
+// Discrete fields come from a; continuous ones are blended by w (0: a, 1: b)
+static void blend_states(const VisualState &a, const VisualState &b, float w, VisualState &out) {
+    uint32_t generation = out.generation;
+    out = a;
+    out.generation = generation;
+    auto mix = [w](float x, float y) { return x + (y - x) * w; };
+    out.colourLevel = mix(a.colourLevel, b.colourLevel);
+    for (int i = 0; i < g_cfg.segments; i++) out.segment[i] = mix(a.segment[i], b.segment[i]);
+    out.elementWidth = mix(a.elementWidth, b.elementWidth);
+    out.percent = mix(a.percent, b.percent);
+    for (int k = 0; k < 3; k++) {
+        out.elementColorRGB[k] = mix(a.elementColorRGB[k], b.elementColorRGB[k]);
+        out.backgroundColorRGB[k] = mix(a.backgroundColorRGB[k], b.backgroundColorRGB[k]);
+    }
+    // Layers blend pairwise while both lists are the same length and shape
+    for (int i = 0; a.nlayers == b.nlayers && i < a.nlayers; i++) {
+        const Layer &la = a.layer[i], &lb = b.layer[i];
+        if (la.geometryMode != lb.geometryMode) continue;
+        Layer &l = out.layer[i];
+        l.radius = mix(la.radius, lb.radius);
+        l.width = mix(la.width, lb.width);
+        l.percent = mix(la.percent, lb.percent);
+        for (int k = 0; k < 3; k++) l.colorRGB[k] = mix(la.colorRGB[k], lb.colorRGB[k]);
+    }
+}
+
+/**
+ * Samples a timeline `elapsed` seconds after playback started. A
+ * non-looping timeline blends linearly from `from` (the state at playback
+ * start) into its first keyframe; a looping one wraps from its last
+ * keyframe instead. Returns false once a non-looping timeline is over, with
+ * out holding the final keyframe.
+ */
+static bool sample_timeline(const Timeline &tl, float elapsed, const VisualState &from, VisualState &out) {
+    float duration = tl.duration();
+    if (tl.loop) elapsed = fmodf(elapsed, duration);
+    else if (elapsed >= duration) { blend_states(tl.key[tl.count - 1].state, tl.key[tl.count - 1].state, 0.0f, out); return false; }
+
+    int next = 0;
+    while (tl.key[next].t <= elapsed) next++;   // elapsed < duration, so this stops inside the array
+
+    if (next == 0) {
+        const Keyframe &last = tl.key[tl.count - 1];
+        const VisualState &a = tl.loop ? last.state : from;
+        uint8_t ease = tl.loop ? last.ease : (uint8_t)EASE_LINEAR;
+        blend_states(a, tl.key[0].state, apply_ease(ease, elapsed / tl.key[0].t), out);
     } else {
-        // HOT: Yellow -> Red
-        float t = (c - 66.0f) / 34.0f;
-        rgb[0] = 1.0f;
-        rgb[1] = 1.0f - t;
-        rgb[2] = 0.0f;
+        const Keyframe &a = tl.key[next - 1], &b = tl.key[next];
+        blend_states(a.state, b.state, apply_ease(a.ease, (elapsed - a.t) / (b.t - a.t)), out);
+    }
+    return true;
+}
+
+/**
+ * Parses a POST /timeline body into tl, resolving each keyframe on top of
+ * `base`. On failure err names the problem.
+ */
+static bool parse_timeline_json(const char *body, size_t len, const VisualState &base, Timeline &tl, const char *&err) {
+    JsonCursor c(body, len);
+    char key[24], str[16];
+    bool trunc, haveKeyframes = false;
+    VisualState state = base;
+    tl.count = 0;
+    tl.loop = false;
+
+    err = "Invalid JSON";
+    if (!c.eat('{')) return false;
+    if (!c.eat('}')) {
+        do {
+            if (!c.string(key, sizeof(key), trunc) || !c.eat(':')) return false;
+            if (trunc) key[0] = '\0';
+
+            if (!strcmp(key, "loop")) {
+                if (!c.boolean(tl.loop)) return false;
+            } else if (!strcmp(key, "keyframes")) {
+                haveKeyframes = true;
+                if (!c.eat('[')) return false;
+                if (c.eat(']')) continue;
+                do {
+                    if (tl.count == MAX_KEYFRAMES) { err = "Too many keyframes"; return false; }
+                    Keyframe &k = tl.key[tl.count];
+                    UpdateFields f;
+                    bool haveT = false;
+                    k.ease = EASE_LINEAR;
+
+                    if (!c.eat('{')) return false;
+                    if (!c.eat('}')) {
+                        do {
+                            if (!c.string(key, sizeof(key), trunc) || !c.eat(':')) return false;
+                            if (trunc) key[0] = '\0';
+                            if (!strcmp(key, "t")) {
+                                if (!c.number(k.t)) return false;
+                                haveT = true;
+                            } else if (!strcmp(key, "ease")) {
+                                if (!c.string(str, sizeof(str), trunc)) return false;
+                                k.ease = EASE_COUNT;
+                                for (int e = 0; e < EASE_COUNT; e++)
+                                    if (!trunc && !strcmp(str, EASE_NAMES[e])) k.ease = (uint8_t)e;
+                                if (k.ease == EASE_COUNT) { err = "Unknown ease"; return false; }
+                            } else {
+                                FieldResult r = parse_update_field(c, key, f);
+                                if (r == FIELD_INVALID || (r == FIELD_UNKNOWN && !c.skip())) return false;
+                            }
+                        } while (c.eat(','));
+                        if (!c.eat('}')) return false;
+                    }
+
+                    if (!haveT || !(k.t >= 0.0f && k.t <= MAX_TIMELINE_SEC)) { err = "Keyframe needs a t between 0 and 86400"; return false; }
+                    if (tl.count > 0 && k.t < tl.key[tl.count - 1].t) { err = "Keyframes must be sorted by t"; return false; }
+                    apply_update(f, state);
+                    k.state = state;
+                    tl.count++;
+                } while (c.eat(','));
+                if (!c.eat(']')) return false;
+            } else if (!c.skip()) {
+                return false;
+            }
+        } while (c.eat(','));
+        if (!c.eat('}')) return false;
     }
+    if (!c.done()) return false;
+
+    if (!haveKeyframes) { err = "Missing keyframes"; return false; }
+    if (tl.loop && tl.count > 0 && !(tl.duration() > 0.0f)) { err = "A looping timeline needs a last keyframe with t > 0"; return false; }
+    return true;
 }
 
 // =======================================================
@@ -410,21 +1810,47 @@ static const char *vertexShaderCode = STRINGIFY(
 
 static const char *fragmentShaderHeader = STRINGIFY(
     precision mediump float;
-    const int SEGMENTS = ) RESTRINGIFY(SEGMENTS) STRINGIFY(;
     const float CT1 = ) RESTRINGIFY(CT1) STRINGIFY(;
     const float CT2 = ) RESTRINGIFY(CT2) STRINGIFY(;
     const float CT3 = ) RESTRINGIFY(CT3) STRINGIFY(;
     uniform float colourLevel;
-    uniform float segment[SEGMENTS];
+    uniform sampler2D u_segTex; // (SEGMENTS+1) x 1 segment levels 0..1, last texel repeats segment 0
     uniform float age;
     uniform float time;
+    uniform float u_grayStart;  // signal-loss fade window (seconds of age)
+    uniform float u_grayEnd;
     uniform int u_geom;
     uniform vec3 u_bgColor;
     uniform vec3 u_elementColor;
     uniform float u_width;   // 0..100
     uniform float u_percent; // 0..1
+    uniform sampler2D u_bgTex;  // low-resolution background (--bg-scale > 1 only)
+    uniform float u_bgScale;    // full-res pixels per background texel
+    uniform int u_layerCount;   // element layers in front of the primary geometry
+    uniform vec4 u_layerShape[MAX_LAYERS];  // geometry, radius 0..100, width 0..100, percent 0..1
+    uniform vec3 u_layerColor[MAX_LAYERS];
     varying vec2 fragCoord;
 
+    // Background texture coordinate of this pixel, clamped to its own panel
+    // (half a texel inside) so bilinear filtering never blends two faces
+    vec2 bgTexCoord() {
+        float x0 = floor(gl_FragCoord.x / BG_PANEL_W) * BG_PANEL_W;
+        float inset = 0.5 * u_bgScale;
+        float x = clamp(gl_FragCoord.x, x0 + inset, x0 + BG_PANEL_W - inset);
+        return vec2(x, gl_FragCoord.y) / BG_SIZE;
+    }
+
+    // Segment level at angle phi (0..SEGMENTS): a blend of the two nearest
+    // segments with weights 1-s and s, s = smoothstep(0, 1, frac(phi)). The
+    // remapped coordinate lets the linear texture filter do the blend; the
+    // extra texel makes the last segment wrap into the first.
+    float segmentAt(float phi) {
+        float i = floor(phi);
+        float s = smoothstep(0.0, 1.0, phi - i);
+        i = mod(i, float(SEGMENTS));
+        return texture2D(u_segTex, vec2((i + 0.5 + s) / float(SEGMENTS + 1), 0.5)).r;
+    }
+
     // Helper: Unified Wobble Calculation
     float getWobble(vec2 uv) {
         return (sin(normalize(uv).y * 5.0 + time * 2.0) - sin(normalize(uv).x * 5.0 + time * 2.0)) / 100.0;
@@ -439,7 +1865,7 @@ static const char *fragmentShaderHeader = STRINGIFY(
 
     // Updated Box: Supports thickness and wobble
     float sdBox(vec2 p, float b, float width, float segf) {
-        float wobble = (u_geom == 2) ? getWobble(p) : 0.0;
+        float wobble = getWobble(p);
         vec2 d = abs(p) - b;
         float f = length(max(d, 0.0)) + min(max(d.x, d.y), 0.0) + wobble;
         float w = width + width * segf * 0.1; // Thickness logic
@@ -449,7 +1875,7 @@ static const char *fragmentShaderHeader = STRINGIFY(
     // Updated Triangle: Supports thickness and wobble
     float triangle(vec2 p, float r, float width, float segf) {
         const float k = sqrt(3.0);
-        float wobble = (u_geom == 3) ? getWobble(p) : 0.0;
+        float wobble = getWobble(p);
         p.x = abs(p.x) - r;
         p.y = p.y + r/k;
         if( p.x+k*p.y>0.0 ) p = vec2(p.x-k*p.y,-k*p.x-p.y)/2.0;
@@ -460,7 +1886,7 @@ static const char *fragmentShaderHeader = STRINGIFY(
     }
 
 	// Percent (0..1) arc mask with smooth edges
-	float arcMask(vec2 uv, float pct) {
+	float arcRamp(vec2 uv, float pct) {
 		// If percent is 100%, return 1.0 immediately to avoid the 'seam' gap
 		if (pct >= 0.99) return 1.0;
 
@@ -474,22 +1900,61 @@ static const char *fragmentShaderHeader = STRINGIFY(
 		return startRamp * endRamp;
 	}
 
+	// Primary element: full-arc variants drop the mask at compile time
+	float arcMask(vec2 uv, float pct) {
+		return FULL_ARC ? 1.0 : arcRamp(uv, pct);
+	}
+
+    // One element layer: the primary geometry code with runtime geometry and radius
+    float layerShape(vec2 uv, vec4 s, float segf) {
+        float r = s.y / 200.0;
+        float width01 = clamp(s.z / 100.0, 0.0, 1.0);
+        float pmask = arcRamp(uv, s.w);
+        float baseWidth = mix(0.01, mix(0.003, 0.08, width01), pmask);
+        float activeWobble = segf * pmask;
+        if (s.x < 0.5) return ring(uv, r, baseWidth, activeWobble);
+        if (s.x < 1.5) {
+            float edge = mix(0.01, 0.08, width01);
+            return (1.0 - smoothstep(r-edge, r+edge, length(uv) + getWobble(uv))) * pmask;
+        }
+        if (s.x < 2.5) return sdBox(uv, r * 0.88, baseWidth, activeWobble);
+        if (s.x < 3.5) return triangle(uv, r, baseWidth, activeWobble);
+        vec2 d = abs(uv);
+        float dist = abs(d.x - d.y) + getWobble(uv) * pmask;
+        float w = baseWidth + baseWidth * activeWobble * 0.1;
+        return float(dist < w) * float(length(uv) < r * 1.2);
+    }
+
+
     void main() {
         vec2 coords = fragCoord.xy * 0.5;
         float phi = (atan(coords.y, coords.x) + 3.14159) / 3.14159 * float(SEGMENTS) * 0.5;
-        float segmentf = 0.0;
+        float segmentf = segmentAt(phi);
 );
 
-static const char *fragmentShaderFooter = STRINGIFY(
+// Plasma iteration counts (see ThermalTier::cheapPlasma)
+static const int PLASMA_ITER_FULL = 8, PLASMA_ITER_CHEAP = 4;
+static const int PLASMA_VARIANTS = 2;               // full, cheap
+
+/**
+ * "Magic Shine" procedural background. Inlined into main() by both the
+ * composite shader and the low-resolution background pass (as statements,
+ * not a function, so the inline build compiles exactly as before); expects
+ * fragCoord, coords and the time / u_bgColor uniforms in scope and defines
+ * outcolor. PLASMA_ITER is the iteration count: PLASMA_ITER_FULL, or
+ * PLASMA_ITER_CHEAP for the variant the hotter thermal tiers switch to.
+ */
+
+static const char *magicShineCode = STRINGIFY(
         // This is your original procedural background. We tint it with u_bgColor.
         vec2 p = fragCoord.xy * 0.5 * 10.0 - vec2(19.0);
         vec2 i = p; float c = 1.0; float inten = 0.05;
-        for (int n = 0; n < 8; n++) {
+        for (int n = 0; n < PLASMA_ITER; n++) {
             float t_inner = time * (0.7 - (0.2 / float(n+1)));
             i = p + vec2(cos(t_inner - i.x) + sin(t_inner + i.y), sin(t_inner - i.y) + cos(t_inner + i.x));
             c += 1.0 / length(vec2(p.x / (2.0 * sin(i.x + t_inner) / inten), p.y / (cos(i.y + t_inner) / inten)));
         }
-        c /= 8.0; c = 1.5 - sqrt(c*c);
+        c /= float(PLASMA_ITER); c = 1.5 - sqrt(c*c);
 
         // --- New Magic Shine Logic ---
         // Calculate a spatial shift based on X/Y position and time to create organic variation
@@ -510,6 +1975,32 @@ static const char *fragmentShaderFooter = STRINGIFY(
 
         // Background: Apply the original "c" energy to the new dynamic shimmer color
         vec3 outcolor = shimmerColor * c * c * c * c;
+);
+
+// Composite with a background pass: bilinear sample of the low-resolution plasma
+static const char *bgSampleCode = STRINGIFY(
+        vec3 outcolor = texture2D(u_bgTex, bgTexCoord()).rgb;
+);
+
+// Low-resolution background pass: the plasma alone, upsampled by the composite pass
+static const char *backgroundPassHeader = STRINGIFY(
+    precision mediump float;
+    uniform float time;
+    uniform vec3 u_bgColor;
+    varying vec2 fragCoord;
+);
+
+static const char *backgroundPassMainStart = STRINGIFY(
+    void main() {
+        vec2 coords = fragCoord.xy * 0.5;
+);
+
+static const char *backgroundPassMainEnd = STRINGIFY(
+        gl_FragColor = vec4(outcolor, 1.0);
+    }
+);
+
+static const char *fragmentShaderFooter = STRINGIFY(
 
         // Geometry thickness and mask logic
         float pmask = arcMask(coords, u_percent);
@@ -528,25 +2019,26 @@ static const char *fragmentShaderFooter = STRINGIFY(
 
         float shape = 0.0;
 
-        if (u_geom == 0) {
+        if (GEOM == 0) {
             // Ring now uses the variable baseWidth and activeWobble (no pmask multiplier so thin part shows)
             shape = ring(coords, 0.25, baseWidth, activeWobble);
-        } else if (u_geom == 1) {
+        } else if (GEOM == 1) {
             // filled disc, "width" influences edge softness a little
             float r0 = 0.25;
             float edge = mix(0.01, 0.08, clamp(u_width / 100.0, 0.0, 1.0));
             // Circles remain special: we hide the inactive part for a true arc
             shape = (1.0 - smoothstep(r0-edge, r0+edge, length(coords) + getWobble(coords))) * pmask;
-        } else if (u_geom == 2) {
+        } else if (GEOM == 2) {
             shape = sdBox(coords, 0.22, baseWidth, activeWobble);
-        } else if (u_geom == 3) {
+        } else if (GEOM == 3) {
             shape = triangle(coords, 0.25, baseWidth, activeWobble);
-        } else if (u_geom == 4) {
+        } else if (GEOM == 4) {
             // X-Shape with wobble and thickness
             vec2 d = abs(coords);
             float dist = abs(d.x - d.y) + getWobble(coords) * pmask;
             float w = baseWidth + baseWidth * activeWobble * 0.1;
-            shape = ((dist < w && length(coords) < 0.3) ? 1.0 : 0.0);
+            // Branch-free form: Mesa produced a wrong mask from the '&&' ternary once GEOM is a constant
+            shape = float(dist < w) * float(length(coords) < 0.3);
         }
 
         // IMPORTANT: element color must be purely that color, IN FRONT.
@@ -561,8 +2053,8 @@ static const char *fragmentShaderFooter = STRINGIFY(
          *
          * Timing behavior:
          * - `age` represents the elapsed time (in seconds) since the last update.
-         * - Grayscale blending starts after GRAY_START_TIME seconds.
-         * - The image becomes fully grayscale after GRAY_END_TIME seconds.
+         * - Grayscale blending starts after u_grayStart seconds.
+         * - The image becomes fully grayscale after u_grayEnd seconds.
          *
          * Implementation details:
          * - The fade is performed entirely in the fragment shader.
@@ -572,25 +2064,29 @@ static const char *fragmentShaderFooter = STRINGIFY(
          * (ITU-R BT.601).
          *
          * Configuration:
-         * - GRAY_START_TIME and GRAY_END_TIME are compile-time constants defined
-         * at the top of this file.
-         * - Changing these values requires recompilation but does not affect
-         * runtime performance or OpenGL state.
+         * - u_grayStart and u_grayEnd come from LiveConfig (gray-start and
+         * gray-end, adjustable at runtime through POST /config).
          *
          * Note:
-         * This visual fade is independent of BLANKINTERVAL.
-         * BLANKINTERVAL controls full canvas blanking, while this logic only
+         * This visual fade is independent of blank-interval.
+         * blank-interval controls full canvas blanking, while this logic only
          * provides visual feedback for short signal loss.
          *
          * IMPORTANT (requested):
          * Grayscale fade affects BACKGROUND ONLY. Element stays pure.
          */
         vec3 gray_bg = vec3(dot(vec3(0.3, 0.59, 0.11), outcolor));
-        vec3 faded_bg = mix(outcolor, gray_bg, smoothstep(GRAY_START, GRAY_END, age));
+        vec3 faded_bg = mix(outcolor, gray_bg, smoothstep(u_grayStart, u_grayEnd, age));
 
         // Re-compose after grayscale so the element stays pure and in front.
         vec3 finalColor = mix(faded_bg, u_elementColor, clamp(shape, 0.0, 1.0));
 
+        // Element layers, back to front, in the same pass
+        for (int l = 0; l < MAX_LAYERS; l++) {
+            if (l >= u_layerCount) break;
+            finalColor = mix(finalColor, u_layerColor[l], clamp(layerShape(coords, u_layerShape[l], segmentf), 0.0, 1.0));
+        }
+
         gl_FragColor = vec4(finalColor, 1.0);
     }
 );
@@ -598,332 +2094,3610 @@ static const char *fragmentShaderFooter = STRINGIFY(
 // =======================================================
 // GL HELPERS
 // =======================================================
-static bool check_gl_shader(GLuint sh, const char *label) {
+// Failures are logged; err (optional) receives the info log, e.g. for the POST /shader reply
+static bool check_gl_shader(GLuint sh, const char *label, std::string *err = nullptr) {
     GLint ok = 0; glGetShaderiv(sh, GL_COMPILE_STATUS, &ok);
     if (!ok) {
         GLint len = 0; glGetShaderiv(sh, GL_INFO_LOG_LENGTH, &len);
         std::vector<char> log(len > 1 ? len : 2, 0);
         glGetShaderInfoLog(sh, len, nullptr, log.data());
+        if (err) *err = log.data();
         log_ts("GL ERROR: " + std::string(label) + "\n" + log.data()); return false;
     }
     return true;
 }
 
-static bool check_gl_program(GLuint prog) {
+static bool check_gl_program(GLuint prog, std::string *err = nullptr) {
     GLint ok = 0; glGetProgramiv(prog, GL_LINK_STATUS, &ok);
     if (!ok) {
         GLint len = 0; glGetProgramiv(prog, GL_INFO_LOG_LENGTH, &len);
         std::vector<char> log(len > 1 ? len : 2, 0);
         glGetProgramInfoLog(prog, len, nullptr, log.data());
+        if (err) *err = log.data();
         log_ts("GL LINK ERROR:\n" + std::string(log.data())); return false;
     }
     return true;
 }
 
-// =======================================================
-// REST API
-// =======================================================
-void startRestApi() {
-    httplib::Server svr; g_server = &svr;
-    svr.new_task_queue = [] { return new httplib::ThreadPool(3); };
-
-    auto set_cors = [](httplib::Response &res) {
-        res.set_header("Access-Control-Allow-Origin", "*");
-        res.set_header("Access-Control-Allow-Methods", "POST, GET, OPTIONS");
-        res.set_header("Access-Control-Allow-Headers", "X-API-Token, Content-Type");
-    };
-
-    svr.Options(R"(.*)", [&](const httplib::Request&, httplib::Response& res) { set_cors(res); res.status = 204; });
-
-    svr.Post("/update", [&](const httplib::Request& req, httplib::Response& res) {
-        set_cors(res);
-        if (req.get_header_value("X-API-Token") != API_TOKEN) { res.status = 401; return; }
-
-        const std::string &b = req.body;
-        std::lock_guard<std::mutex> lk(state_mtx);
-
-        bool any = false;
+/**
+ * Built-in programs saved with GL_OES_get_program_binary (shader-cache=DIR),
+ * so a restart loads the program variants instead of compiling them. A file
+ * is named after the FNV-1a hash of the driver strings and both sources and
+ * repeats hash and length in its header; a binary the driver refuses (e.g.
+ * after a driver update) is compiled again and the file rewritten.
+ * init() runs once with the render context current; load() and store()
+ * are safe from any thread with a context that shares its objects.
+ */
+class ProgramCache {
+public:
+    void init(const std::string &dir) {
+        if (dir.empty()) return;
+        const char *ext = (const char *)glGetString(GL_EXTENSIONS);
+        GLint formats = 0;
+        if (ext && strstr(ext, "GL_OES_get_program_binary")) glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+        get_ = (PFNGLGETPROGRAMBINARYOESPROC)eglGetProcAddress("glGetProgramBinaryOES");
+        put_ = (PFNGLPROGRAMBINARYOESPROC)eglGetProcAddress("glProgramBinaryOES");
+        if (formats < 1 || !get_ || !put_) { log_ts("GL: No program binary support, shader-cache disabled"); return; }
+        if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+            log_ts("GL: Cannot create " + dir + ": " + strerror(errno) + ", shader-cache disabled");
+            return;
+        }
+        dir_ = dir;
+        driver_ = std::string((const char *)glGetString(GL_RENDERER)) + '\0' + (const char *)glGetString(GL_VERSION) + '\0';
+    }
 
-        // Track presence of fields in THIS request (minimal fix: mode switching must not reuse old flags)
-        bool gotColour = false;
-        bool gotElementColor = false;
-        bool gotBackgroundColor = false;
+    bool enabled() const { return !dir_.empty(); }
+    uint64_t hits() const { return hits_.load(); }
+    uint64_t misses() const { return misses_.load(); }
 
-        try {
-            // NEW: mode (heat/custom)
-            std::string mode;
-            if (extract_json_string(b, "mode", mode)) {
-                tmodeStr = mode;
-                any = true;
+    /** Program linked from the cached binary for these sources, or 0. */
+    GLuint load(const std::string &sources) {
+        if (!enabled()) return 0;
+        Key k = key(sources);
+        GLuint prog = 0;
+        FILE *f = fopen(k.path.c_str(), "rb");
+        FileHeader h;
+        if (f && fread(&h, sizeof(h), 1, f) == 1 && memcmp(h.magic, MAGIC, sizeof(h.magic)) == 0
+            && h.hash == k.hash && h.sourceBytes == k.bytes && h.length > 0 && h.length <= MAX_BINARY_BYTES) {
+            std::vector<char> bin(h.length);
+            if (fread(bin.data(), 1, bin.size(), f) == bin.size()) {
+                prog = glCreateProgram();
+                put_(prog, h.format, bin.data(), (GLint)bin.size());
+                GLint ok = 0; glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+                if (!ok) { glDeleteProgram(prog); prog = 0; }
             }
+        }
+        if (f) fclose(f);
+        (prog ? hits_ : misses_)++;
+        return prog;
+    }
 
-            // OLD: colour (0..100)
-            float col;
-            if (extract_json_number(b, "colour", col)) {
-                tcolourLevel = col;
-                gotColour = true;
-                any = true;
-            }
+    /** Saves a linked program (write to a temporary file, then rename). */
+    void store(GLuint prog, const std::string &sources) {
+        if (!enabled()) return;
+        GLint len = 0; glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH_OES, &len);
+        if (len <= 0 || (uint32_t)len > MAX_BINARY_BYTES) return;
+        std::vector<char> bin(len);
+        GLenum format = 0;
+        get_(prog, len, &len, &format, bin.data());
+        Key k = key(sources);
+        FileHeader h;
+        memcpy(h.magic, MAGIC, sizeof(h.magic));
+        h.format = format; h.length = (uint32_t)len; h.hash = k.hash; h.sourceBytes = k.bytes;
+        std::string tmp = k.path + ".tmp";
+        FILE *f = fopen(tmp.c_str(), "wb");
+        bool ok = f && fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(bin.data(), 1, len, f) == (size_t)len;
+        if (f && fclose(f) != 0) ok = false;
+        if (!ok || rename(tmp.c_str(), k.path.c_str()) != 0) {
+            unlink(tmp.c_str());
+            log_ts("GL: Cannot write " + k.path);
+        }
+    }
 
-            // Geometry (old/new)
-            std::string geom;
-            if (extract_json_string(b, "geometry", geom)) {
-                if (geom == "ring")     { tgeometryMode = 0; tgeomStr = "ring"; }
-                else if (geom == "circle")   { tgeometryMode = 1; tgeomStr = "circle"; }
-                else if (geom == "square")   { tgeometryMode = 2; tgeomStr = "square"; }
-                else if (geom == "triangle") { tgeometryMode = 3; tgeomStr = "triangle"; }
-                else if (geom == "x")        { tgeometryMode = 4; tgeomStr = "x"; }
-                any = true;
-            }
+private:
+    static constexpr const char *MAGIC = "LEDPRG01";
+    static const uint32_t MAX_BINARY_BYTES = 16 << 20;
 
-            // Segments (old/new)
-            int nseg = 0;
-            if (extract_json_array_floats(b, "segments", tsegment, SEGMENTS, nseg)) {
-                any = true;
-            }
+    struct FileHeader {
+        char     magic[8];
+        uint32_t format;        // GL binary format enum
+        uint32_t length;        // binary bytes after the header
+        uint32_t hash;          // fnv1a32 of driver strings + sources
+        uint32_t sourceBytes;
+    };
+    struct Key { uint32_t hash; uint32_t bytes; std::string path; };
 
-            // NEW: width (0..100) thickness
-            float w;
-            if (extract_json_number(b, "width", w)) {
-                telementWidth = compat::clamp(w, 0.0f, 100.0f);
-                any = true;
-            }
+    Key key(const std::string &sources) const {
+        std::string all = driver_ + sources;
+        Key k;
+        k.hash = fnv1a32(all.data(), all.size());
+        k.bytes = (uint32_t)all.size();
+        char name[16];
+        snprintf(name, sizeof(name), "%08x.bin", k.hash);
+        k.path = dir_ + "/" + name;
+        return k;
+    }
 
-            // NEW: percent (0..1) arc coverage
-            float pct;
-            if (extract_json_number(b, "percent", pct)) {
-                tpercent = compat::clamp(pct, 0.0f, 1.0f);
-                any = true;
-            }
+    std::string dir_, driver_;
+    PFNGLGETPROGRAMBINARYOESPROC get_ = nullptr;
+    PFNGLPROGRAMBINARYOESPROC put_ = nullptr;
+    std::atomic<uint64_t> hits_{0}, misses_{0};
+};
 
-            // NEW: elementColor
-            std::string ehex;
-            if (extract_json_string(b, "elementColor", ehex)) {
-                float rgb[3];
-                if (parse_hex_color(ehex, rgb)) {
-                    telementColorRGB[0] = rgb[0];
-                    telementColorRGB[1] = rgb[1];
-                    telementColorRGB[2] = rgb[2];
-                    thaveElementColor = true;
-                    gotElementColor = true;
-                    any = true;
-                }
-            }
+static ProgramCache g_programCache;
 
-            // NEW: backgroundColor
-            std::string bhex;
-            if (extract_json_string(b, "backgroundColor", bhex)) {
-                float rgb[3];
-                if (parse_hex_color(bhex, rgb)) {
-                    tbackgroundColorRGB[0] = rgb[0];
-                    tbackgroundColorRGB[1] = rgb[1];
-                    tbackgroundColorRGB[2] = rgb[2];
-                    thaveBackgroundColor = true;
-                    gotBackgroundColor = true;
-                    any = true;
-                }
-            }
+/**
+ * Fragment shader source. geom < 0 builds the generic program, which reads
+ * the geometry from u_geom and tests the full-arc case at runtime; otherwise
+ * GEOM and FULL_ARC are compile-time constants, so the compiler folds the
+ * geometry chain down to one shape and full-arc variants drop the atan()
+ * arc mask entirely. bgTexture samples the background from the
+ * low-resolution pass instead of running the plasma per pixel; otherwise
+ * cheapPlasma selects the iteration count of the inline plasma.
+ */
+static std::string shader_prelude(int geom, bool fullArc) {
+    std::string fsSource;
+    if (geom < 0) {
+        fsSource = "#define GEOM u_geom\n#define FULL_ARC false\n";
+    } else {
+        fsSource = "#define GEOM " + std::to_string(geom) + "\n#define FULL_ARC " + (fullArc ? "true" : "false") + "\n";
+    }
+    fsSource += "const int SEGMENTS = " + std::to_string(g_cfg.segments) + ";\n";
+    fsSource += "#define MAX_LAYERS " + std::to_string(MAX_LAYERS) + "\n";
+    fsSource += "#define BG_PANEL_W " + std::to_string(PANEL_W) + ".0\n"
+                "#define BG_SIZE vec2(" + std::to_string(W) + ".0, " + std::to_string(H) + ".0)\n";
+    return fsSource;
+}
 
-            // Apply requested "heat mode" enforcement:
-            // - geometry forced to ring
-            // - element color forced to white
-            // - background uses translated colourLevel (unless explicit backgroundColor provided)
-            if (tmodeStr == "heat") {
-                tgeometryMode = 0; tgeomStr = "ring";
-                telementColorRGB[0] = 1.0f; telementColorRGB[1] = 1.0f; telementColorRGB[2] = 1.0f;
-                thaveElementColor = true;
-
-                // Minimal fix: In heat mode, background MUST follow heat translation unless THIS request explicitly provides backgroundColor.
-                if (!gotBackgroundColor) {
-                    float rgb[3];
-                    heat_colour_to_bg(tcolourLevel, rgb);
-                    tbackgroundColorRGB[0] = rgb[0];
-                    tbackgroundColorRGB[1] = rgb[1];
-                    tbackgroundColorRGB[2] = rgb[2];
-                    thaveBackgroundColor = true;
-                }
+static std::string plasma_define(bool cheap) {
+    return "#define PLASMA_ITER " + std::to_string(cheap ? PLASMA_ITER_CHEAP : PLASMA_ITER_FULL) + "\n";
+}
 
-                // percent/width are optional in heat mode; leave whatever was set.
-            } else {
-                // In custom mode: if legacy colour is present but backgroundColor isn't,
-                // translate colour to backgroundColor (requested).
-                if (!gotBackgroundColor && gotColour) {
-                    float rgb[3];
-                    heat_colour_to_bg(tcolourLevel, rgb);
-                    tbackgroundColorRGB[0] = rgb[0];
-                    tbackgroundColorRGB[1] = rgb[1];
-                    tbackgroundColorRGB[2] = rgb[2];
-                    thaveBackgroundColor = true;
-                }
-                // elementColor may or may not be present; if absent, keep previous.
-            }
+static std::string build_fragment_source(int geom, bool fullArc, bool bgTexture, bool cheapPlasma) {
+    std::string fsSource = shader_prelude(geom, fullArc);
+    if (!bgTexture) fsSource += plasma_define(cheapPlasma);
+    fsSource += fragmentShaderHeader;
 
-            if (!any) { res.status = 400; res.set_content("No valid fields", "text/plain"); return; }
+    // Background: computed inline, or sampled from the low-resolution background pass
+    fsSource += bgTexture ? bgSampleCode : magicShineCode;
+    fsSource += fragmentShaderFooter;
+    return fsSource;
+}
 
-            updateTime = t;
-            log_ts("API: Updated Targets (Mode=" + tmodeStr + ", Color=" + fmt_float(tcolourLevel) + ", Geom=" + tgeomStr + ")");
-        } catch (...) {
-            res.status = 400; res.set_content("Invalid JSON", "text/plain"); return;
-        }
+// One linked fragment program variant and its uniform locations
+struct ShaderProgram {
+    GLuint prog = 0;
+    GLint u_time = -1, u_age = -1, u_colourLevel = -1, u_segTex = -1, u_geom = -1;
+    GLint u_bgColor = -1, u_elColor = -1, u_width = -1, u_percent = -1;
+    GLint u_bgTex = -1, u_bgScale = -1, u_grayStart = -1, u_grayEnd = -1;
+    GLint u_layerCount = -1, u_layerShape = -1, u_layerColor = -1;
+};
 
-        res.status = 200;
-        res.set_content("OK", "text/plain");
-    });
+// Vertex attributes are bound to fixed slots so every variant shares the VBO setup
+static const GLuint ATTR_POS = 0, ATTR_COORD = 1;
 
-    svr.Get("/status", [&](const httplib::Request&, httplib::Response& res) {
-        set_cors(res); std::lock_guard<std::mutex> lk(state_mtx);
-        float age = t - updateTime;
-        std::ostringstream json;
-        json << "{"
-             << "\"colour\":" << colourLevel
-             << ",\"geometry\":\"" << tgeomStr << "\""
-             << ",\"segments\":" << segments_to_string(segment)
-             << ",\"age\":" << age
-             << ",\"quiet\":" << ((BLANKINTERVAL != 0 && age > BLANKINTERVAL) ? "true" : "false")
-             << ",\"mode\":\"" << modeStr << "\""
-             << ",\"width\":" << elementWidth
-             << ",\"percent\":" << percent
-             << "}";
-        res.set_content(json.str(), "application/json");
-    });
+// Links a program from the vertex shader and this fragment source (or the program cache)
+// cached: go through shader-cache (built-in programs only, user shaders would pile up there)
+static bool build_program(GLuint vsh, const std::string &fsSource, const char *label, ShaderProgram &out,
+                          std::string *err = nullptr, bool cached = true) {
+    const std::string sources = std::string(vertexShaderCode) + '\0' + fsSource;
+    GLuint prog = cached ? g_programCache.load(sources) : 0;
+    if (!prog) {
+        const char *src = fsSource.c_str();
+        GLuint fsh = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(fsh, 1, &src, NULL); glCompileShader(fsh);
+        if (!check_gl_shader(fsh, label, err)) { glDeleteShader(fsh); return false; }
 
-    svr.Get("/health", [&](const httplib::Request&, httplib::Response& res) {
-        set_cors(res);
-        auto uptime = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - start_time).count();
-        res.set_content("{\"ok\":true,\"uptime\":" + std::to_string(uptime) + "}", "application/json");
-    });
+        prog = glCreateProgram();
+        glAttachShader(prog, vsh); glAttachShader(prog, fsh);
+        glBindAttribLocation(prog, ATTR_POS, "pos");
+        glBindAttribLocation(prog, ATTR_COORD, "coord");
+        glLinkProgram(prog);
+        glDeleteShader(fsh);    // stays alive while attached
+        if (!check_gl_program(prog, err)) { glDeleteProgram(prog); return false; }
+        if (cached) g_programCache.store(prog, sources);
+    }
 
-    svr.Get("/config", [&](const httplib::Request&, httplib::Response& res) {
-        set_cors(res);
-        std::ostringstream json;
-        json << "{\"width\":" << W << ",\"height\":" << H << ",\"segments\":" << SEGMENTS << ",\"blankInterval\":" << BLANKINTERVAL << ",\"animStep\":" << ANIMSTEP << ",\"targetFps\":" << TARGET_FPS << "}";
-        res.set_content(json.str(), "application/json");
-    });
+    // Cache uniform locations once (critical for performance on Raspberry Pi)
+    out.prog          = prog;
+    out.u_time        = glGetUniformLocation(prog, "time");
+    out.u_age         = glGetUniformLocation(prog, "age");
+    out.u_colourLevel = glGetUniformLocation(prog, "colourLevel");
+    out.u_segTex      = glGetUniformLocation(prog, "u_segTex");
+    out.u_geom        = glGetUniformLocation(prog, "u_geom");
+    out.u_bgColor     = glGetUniformLocation(prog, "u_bgColor");
+    out.u_elColor     = glGetUniformLocation(prog, "u_elementColor");
+    out.u_width       = glGetUniformLocation(prog, "u_width");
+    out.u_percent     = glGetUniformLocation(prog, "u_percent");
+    out.u_bgTex       = glGetUniformLocation(prog, "u_bgTex");
+    out.u_bgScale     = glGetUniformLocation(prog, "u_bgScale");
+    out.u_grayStart   = glGetUniformLocation(prog, "u_grayStart");
+    out.u_grayEnd     = glGetUniformLocation(prog, "u_grayEnd");
+    out.u_layerCount  = glGetUniformLocation(prog, "u_layerCount");
+    out.u_layerShape  = glGetUniformLocation(prog, "u_layerShape");
+    out.u_layerColor  = glGetUniformLocation(prog, "u_layerColor");
+    return true;
+}
+
+/**
+ * Compiles the composite programs (one per geometry x full-arc case, or the
+ * single generic one) and, with bgTexture, the low-resolution background
+ * pass. Whichever of the two runs the plasma is built once per plasma
+ * variant: programs[] holds PLASMA_VARIANTS blocks of NUM_GEOMETRIES * 2
+ * (only the first is filled with bgTexture), bgPrograms[] one per variant.
+ * Logs the total compile time.
+ */
+static bool build_programs(bool bgTexture, ShaderProgram programs[], ShaderProgram bgPrograms[]) {
+    auto t_shaders = std::chrono::steady_clock::now();
+    const uint64_t cached = g_programCache.hits();
+    GLuint vsh = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vsh, 1, &vertexShaderCode, NULL); glCompileShader(vsh);
+    if (!check_gl_shader(vsh, "Vertex")) return false;
 
-    log_ts("API: Listening on port " + std::to_string(API_PORT));
-    svr.listen("0.0.0.0", API_PORT);
+    int programCount = 0;
+    for (int cheap = 0; cheap < (bgTexture ? 1 : PLASMA_VARIANTS); cheap++) {
+        ShaderProgram *block = programs + cheap * NUM_GEOMETRIES * 2;
+        const char *variant = cheap ? ", cheap" : "";
+        if (!SPECIALIZE_SHADERS) {
+            std::string label = std::string("Fragment") + (cheap ? " (cheap)" : "");
+            if (!build_program(vsh, build_fragment_source(-1, false, bgTexture, cheap != 0), label.c_str(), block[0])) return false;
+            programCount++;
+        }
+        for (int g = 0; SPECIALIZE_SHADERS && g < NUM_GEOMETRIES; g++) {
+            for (int full = 0; full < 2; full++) {
+                std::string label = std::string("Fragment (") + GEOM_NAMES[g] + (full ? ", full" : "") + variant + ")";
+                if (!build_program(vsh, build_fragment_source(g, full != 0, bgTexture, cheap != 0), label.c_str(), block[g * 2 + full])) return false;
+                programCount++;
+            }
+        }
+    }
+    for (int cheap = 0; bgTexture && cheap < PLASMA_VARIANTS; cheap++) {
+        std::string bgSource = plasma_define(cheap != 0) + backgroundPassHeader + backgroundPassMainStart + magicShineCode + backgroundPassMainEnd;
+        if (!build_program(vsh, bgSource, cheap ? "Fragment (background, cheap)" : "Fragment (background)", bgPrograms[cheap])) return false;
+        programCount++;
+    }
+    log_ts("INIT: Compiled " + std::to_string(programCount) + " shader programs in "
+           + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t_shaders).count()) + " ms"
+           + (g_programCache.enabled() ? " (" + std::to_string(g_programCache.hits() - cached) + " from shader-cache)" : std::string()));
+    return true;
 }
 
-// =======================================================
-// MAIN LOOP
-// =======================================================
-int main(int argc, char *argv[]) {
-    log_ts("INIT: Starting Matrix Controller");
+// The render context, kept for the shader reload thread's shared context
+static EGLDisplay g_eglDisplay = EGL_NO_DISPLAY;
+static EGLConfig g_eglConfig;
+static EGLContext g_eglContext = EGL_NO_CONTEXT;
 
-    // EGL Setup
+// Makes a GLES2 context on a W x H pbuffer current; false when EGL cannot provide one
+static bool init_egl() {
     EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
-    eglInitialize(display, NULL, NULL);
-    EGLConfig config; EGLint n;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+        log_ts("INIT: No EGL display (EGL error " + std::to_string(eglGetError()) + ")");
+        return false;
+    }
+    EGLConfig config; EGLint n = 0;
     static const EGLint att[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT, EGL_NONE };
-    eglChooseConfig(display, att, &config, 1, &n);
-    static const EGLint pAtt[] = { EGL_WIDTH, W, EGL_HEIGHT, H, EGL_NONE };
+    if (!eglChooseConfig(display, att, &config, 1, &n) || n < 1) {
+        log_ts("INIT: No EGL pbuffer config for GLES2");
+        return false;
+    }
+    const EGLint pAtt[] = { EGL_WIDTH, W, EGL_HEIGHT, H, EGL_NONE };
     EGLSurface surface = eglCreatePbufferSurface(display, config, pAtt);
     eglBindAPI(EGL_OPENGL_ES_API);
     EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, (const EGLint[]){EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE});
-    eglMakeCurrent(display, surface, surface, context);
+    if (surface == EGL_NO_SURFACE || context == EGL_NO_CONTEXT || !eglMakeCurrent(display, surface, surface, context)) {
+        log_ts("INIT: EGL pbuffer context setup failed (EGL error " + std::to_string(eglGetError()) + ")");
+        return false;
+    }
+    g_eglDisplay = display; g_eglConfig = config; g_eglContext = context;
+    return true;
+}
 
-    // Shader Builder
-    std::string fsSource = fragmentShaderHeader;
+// Offscreen render target: w x h colour texture (GL_RGB or GL_RGBA, 8 bit per channel) attached to an FBO.
+static bool create_fbo(GLuint &fbo, GLuint &tex, GLenum format, int w = W, int h = H, GLint filter = GL_NEAREST) {
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, w, h, 0, format, GL_UNSIGNED_BYTE, NULL);
 
-    /**
-     * Build angular segment blending logic for the fragment shader.
-     *
-     * Each segment contributes to the ring thickness based on its angular
-     * distance to the current fragment angle (phi).
-     *
-     * IMPORTANT:
-     * The distance is computed in circular (wrap-around) space rather than
-     * linear space. This avoids a visible seam and prevents alternating
-     * thick/thin artifacts ("Perlenkette") at the 0 ↔ SEGMENTS boundary.
-     *
-     * Formula:
-     *   d = min(|phi - i|, SEGMENTS - |phi - i|)
-     *
-     * This ensures smooth interpolation between neighboring segments and
-     * guarantees consistent thickness modulation for all geometries
-     * (circle, square, triangle, X), as they all derive their shape
-     * modulation from the same angular parameter.
-     */
-    for (int i = 0; i < SEGMENTS; i++) {
-        char buf[220];
-        sprintf(
-            buf,
-            "float d%d = abs(phi - %d.0);"
-            "d%d = min(d%d, float(SEGMENTS) - d%d);"
-            "segmentf += smoothstep(1.0, 0.0, d%d) * segment[%d];",
-            i, i,
-            i, i, i,
-            i, i
-        );
-        fsSource += buf;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
+    GLenum st = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (st != GL_FRAMEBUFFER_COMPLETE) {
+        log_ts("GL ERROR: framebuffer incomplete (0x" + std::to_string(st) + ")");
+        return false;
     }
+    return true;
+}
 
-    // Minimal fix: normalize segmentf (segments are typically 0..100 from API)
-    // This prevents geometry width from exploding (especially in custom mode) and
-    // keeps thickness behavior consistent between heat and custom.
-    fsSource += "segmentf = clamp(segmentf / 100.0, 0.0, 1.0);\n";
+// =======================================================
+// USER SHADERS (hot reload)
+// =======================================================
+/**
+ * A user fragment shader (shader=PATH, re-read when the file changes, or
+ * POST /shader) replaces the built-in composite programs without a restart.
+ *
+ * Sources are compiled on their own thread, in a second EGL context that
+ * shares objects with the render context, so a compile never stalls a
+ * frame. The finished program is staged like the visual target and the
+ * render loop swaps it in between two frames (try_lock, never a wait), then
+ * deletes the old one. The source is compiled behind the generic program's
+ * #define prelude (GEOM, SEGMENTS, ...) and may declare any of the built-in
+ * uniforms (time, age, u_geom, u_bgColor, u_elementColor, u_width,
+ * u_percent, u_segTex, ...), which are fed as usual. A shader that fails to
+ * compile leaves the running one in place. An empty source (DELETE /shader)
+ * restores the built-in programs.
+ */
+static const int SHADER_POLL_MS = 1000;             // shader=PATH mtime check
+static const int SHADER_REPLY_TIMEOUT_SEC = 10;
+static const size_t MAX_SHADER_BYTES = 64 * 1024;
 
-    // inject gray timing constants
-    fsSource +=
-        "const float GRAY_START = " RESTRINGIFY(GRAY_START_TIME) ";\n"
-        "const float GRAY_END   = " RESTRINGIFY(GRAY_END_TIME) ";\n";
+// One compile request; the submitter waits for done
+struct ShaderJob {
+    std::string source;     // empty: back to the built-in programs
+    bool done = false;      // guarded by shader_mtx
+    std::string error;      // compile/link log when it failed
+};
 
-    fsSource += fragmentShaderFooter;
+static std::mutex shader_mtx;
+static std::condition_variable shader_cv;
+static std::shared_ptr<ShaderJob> g_shaderQueued;       // guarded by shader_mtx; a newer job replaces it
+static ShaderProgram g_shaderStaged;                    // guarded by shader_mtx
+static std::atomic<bool> g_shaderStagedFlag{false};     // g_shaderStaged waits for the render loop
+static std::atomic<bool> g_shaderReady{false};          // the compile thread has its context
+static std::atomic<uint64_t> g_shaderReloadsOk{0}, g_shaderReloadsFailed{0};
 
-    GLuint prog = glCreateProgram();
-    auto comp = [](GLenum type, const char* src) {
-        GLuint s = glCreateShader(type); glShaderSource(s, 1, &src, NULL); glCompileShader(s); return s;
-    };
-    GLuint vsh = comp(GL_VERTEX_SHADER, vertexShaderCode);
-    GLuint fsh = comp(GL_FRAGMENT_SHADER, fsSource.c_str());
-    if(!check_gl_shader(vsh, "Vertex") || !check_gl_shader(fsh, "Fragment")) return 1;
-    glAttachShader(prog, vsh); glAttachShader(prog, fsh);
-    glLinkProgram(prog); if(!check_gl_program(prog)) return 1;
-    glUseProgram(prog);
-
-    // Quad
-    static const GLfloat verts[] = { -1,-1,0, -1,1,0, -0.33,-1,0, -0.33,1,0, -0.33,-1,0, -0.33,1,0, 0.33,-1,0, 0.33,1,0, 0.33,-1,0, 0.33,1,0, 1,-1,0, 1,1,0 };
-    static const GLfloat coords[] = { -0.866,-0.5, -0.866,0.5, 0,-1, 0,0, 0,-1, 0.866,-0.5, 0,0, 0.866,0.5, 0,0, 0.866,0.5, -0.866,0.5, 0,1 };
-    GLuint vbo[2]; glGenBuffers(2, vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo[0]); glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
-    glVertexAttribPointer(glGetAttribLocation(prog, "pos"), 3, GL_FLOAT, GL_FALSE, 0, 0); glEnableVertexAttribArray(glGetAttribLocation(prog, "pos"));
-    glBindBuffer(GL_ARRAY_BUFFER, vbo[1]); glBufferData(GL_ARRAY_BUFFER, sizeof(coords), coords, GL_STATIC_DRAW);
-    glVertexAttribPointer(glGetAttribLocation(prog, "coord"), 2, GL_FLOAT, GL_FALSE, 0, 0); glEnableVertexAttribArray(glGetAttribLocation(prog, "coord"));
-
-    // Matrix
-    //rgb_matrix::RGBMatrix::Options opt; opt.rows = 64; opt.cols = 192; opt.hardware_mapping = "adafruit-hat-pwm"; opt.panel_type = "FM6126A";
-    //rgb_matrix::RuntimeOptions rOpt; rOpt.gpio_slowdown = 2;
-    //RGBMatrix *matrix = rgb_matrix::CreateMatrixFromFlags(&argc, &argv, &opt, &rOpt);
+static void stage_user_shader(const ShaderProgram &sp) {
+    std::lock_guard<std::mutex> lk(shader_mtx);
+    if (g_shaderStaged.prog) glDeleteProgram(g_shaderStaged.prog);   // never taken
+    g_shaderStaged = sp;
+    g_shaderStagedFlag = true;
+}
 
-    //LED Matrix settings
-    rgb_matrix::RGBMatrix::Options defaults;
+/** Render thread: swaps in a staged user program (prog 0: built-ins); true if it did. */
+static bool take_user_shader(ShaderProgram &current) {
+    if (!g_shaderStagedFlag.load()) return false;
+    std::unique_lock<std::mutex> lk(shader_mtx, std::try_to_lock);
+    if (!lk.owns_lock()) return false;
+    if (current.prog) glDeleteProgram(current.prog);
+    current = g_shaderStaged;
+    g_shaderStaged = ShaderProgram();
+    g_shaderStagedFlag = false;
+    return true;
+}
+
+/** API side: compiles source on the shader thread and waits for the outcome. */
+static bool submit_user_shader(const std::string &source, std::string &err) {
+    std::shared_ptr<ShaderJob> job = std::make_shared<ShaderJob>();
+    job->source = source;
+    std::unique_lock<std::mutex> lk(shader_mtx);
+    if (g_shaderQueued) { g_shaderQueued->done = true; g_shaderQueued->error = "Superseded by a newer shader"; }
+    g_shaderQueued = job;
+    shader_cv.notify_all();
+    if (!shader_cv.wait_for(lk, std::chrono::seconds(SHADER_REPLY_TIMEOUT_SEC), [&]{ return job->done || !g_shaderReady; })) {
+        err = "Shader compile timed out";
+        return false;
+    }
+    if (!job->done) {                   // the shader thread stopped before taking it
+        if (g_shaderQueued == job) g_shaderQueued.reset();
+        err = "Shader thread stopped";
+        return false;
+    }
+    err = job->error;
+    return err.empty();
+}
+
+static bool read_text_file(const std::string &path, std::string &out) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    out = ss.str();
+    return true;
+}
+
+void startShaderReload() {
+    const EGLint pAtt[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+    const EGLint cAtt[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+    EGLSurface surface = eglCreatePbufferSurface(g_eglDisplay, g_eglConfig, pAtt);
+    EGLContext context = eglCreateContext(g_eglDisplay, g_eglConfig, g_eglContext, cAtt);
+    if (surface == EGL_NO_SURFACE || context == EGL_NO_CONTEXT || !eglMakeCurrent(g_eglDisplay, surface, surface, context)) {
+        log_ts("GL: No shared context for shader reload (EGL error " + std::to_string(eglGetError()) + ")");
+        return;
+    }
+    GLuint vsh = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vsh, 1, &vertexShaderCode, NULL); glCompileShader(vsh);
+    g_shaderReady = check_gl_shader(vsh, "Vertex (shader reload)");
+    if (g_shaderReady && !g_cfg.shader.empty()) log_ts("GL: Watching " + g_cfg.shader);
+
+    const std::string prelude = shader_prelude(-1, false) + "#line 1\n";    // errors carry the user's line numbers
+    struct stat seen = {};
+    auto nextPoll = std::chrono::steady_clock::now();
+    while (g_shaderReady && !interrupt_received) {
+        std::shared_ptr<ShaderJob> job;
+        {
+            std::unique_lock<std::mutex> lk(shader_mtx);
+            shader_cv.wait_for(lk, std::chrono::milliseconds(200), [] { return g_shaderQueued != nullptr; });
+            job.swap(g_shaderQueued);
+        }
+        std::string label = "POST /shader";
+        if (!job && !g_cfg.shader.empty() && std::chrono::steady_clock::now() >= nextPoll) {
+            nextPoll = std::chrono::steady_clock::now() + std::chrono::milliseconds(SHADER_POLL_MS);
+            struct stat st;
+            if (stat(g_cfg.shader.c_str(), &st) == 0 && (st.st_mtim.tv_sec != seen.st_mtim.tv_sec
+                    || st.st_mtim.tv_nsec != seen.st_mtim.tv_nsec || st.st_size != seen.st_size)) {
+                seen = st;
+                job = std::make_shared<ShaderJob>();
+                label = g_cfg.shader;
+                if (!read_text_file(g_cfg.shader, job->source)) job->error = "Cannot read " + g_cfg.shader;
+                else if (job->source.empty()) job->error = g_cfg.shader + " is empty";
+            }
+        }
+        if (!job) continue;
+
+        auto t0 = std::chrono::steady_clock::now();
+        ShaderProgram sp;
+        std::string err = job->error;
+        if (err.empty() && !job->source.empty()
+            && !build_program(vsh, prelude + job->source, ("Fragment (" + label + ")").c_str(), sp, &err, false) && err.empty())
+            err = "Shader build failed";
+        if (err.empty()) {
+            glFinish();     // complete before the render context uses it
+            stage_user_shader(sp);
+            g_shaderReloadsOk++;
+            log_ts(job->source.empty() ? std::string("GL: Built-in shaders restored")
+                   : "GL: Compiled user shader from " + label + " in " + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count()) + " ms");
+        } else {
+            g_shaderReloadsFailed++;
+            log_ts("GL: User shader from " + label + " rejected, keeping the current one");
+        }
+        std::lock_guard<std::mutex> lk(shader_mtx);
+        job->done = true;
+        job->error = err;
+        shader_cv.notify_all();
+    }
+
+    // Fail a job that is still queued, so its POST /shader answers now instead of holding up shutdown
+    {
+        std::lock_guard<std::mutex> lk(shader_mtx);
+        g_shaderReady = false;
+        if (g_shaderQueued) {
+            g_shaderQueued->done = true;
+            g_shaderQueued->error = "Shutting down";
+            g_shaderQueued.reset();
+        }
+        shader_cv.notify_all();
+    }
+    glDeleteShader(vsh);
+    eglMakeCurrent(g_eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(g_eglDisplay, context);
+    eglDestroySurface(g_eglDisplay, surface);
+}
+
+// =======================================================
+// CPU RENDERER (fallback when GLES2 is unavailable)
+// =======================================================
+/**
+ * Minimal 4-lane float SIMD layer for the CPU renderer: NEON when the
+ * compiler targets it (-mfpu=neon on the Pi 2), plain arrays otherwise so the
+ * same code builds and A/Bs on a desktop. Only the operations the scene needs.
+ */
+namespace simd {
+#ifdef LEDCUBE_NEON
+struct F4 { float32x4_t v; };
+struct M4 { uint32x4_t v; };     // lane mask, all bits set where true
+
+static inline F4 splat(float a) { return { vdupq_n_f32(a) }; }
+static inline F4 load(const float *p) { return { vld1q_f32(p) }; }
+static inline void store(float *p, F4 a) { vst1q_f32(p, a.v); }
+static inline F4 operator+(F4 a, F4 b) { return { vaddq_f32(a.v, b.v) }; }
+static inline F4 operator-(F4 a, F4 b) { return { vsubq_f32(a.v, b.v) }; }
+static inline F4 operator*(F4 a, F4 b) { return { vmulq_f32(a.v, b.v) }; }
+static inline F4 operator-(F4 a) { return { vnegq_f32(a.v) }; }
+static inline F4 min(F4 a, F4 b) { return { vminq_f32(a.v, b.v) }; }
+static inline F4 max(F4 a, F4 b) { return { vmaxq_f32(a.v, b.v) }; }
+static inline F4 abs(F4 a) { return { vabsq_f32(a.v) }; }
+static inline M4 operator<(F4 a, F4 b) { return { vcltq_f32(a.v, b.v) }; }
+static inline M4 operator>(F4 a, F4 b) { return { vcgtq_f32(a.v, b.v) }; }
+static inline M4 operator&(M4 a, M4 b) { return { vandq_u32(a.v, b.v) }; }
+static inline F4 select(M4 m, F4 a, F4 b) { return { vbslq_f32(m.v, a.v, b.v) }; }
+#ifdef __aarch64__
+static inline F4 operator/(F4 a, F4 b) { return { vdivq_f32(a.v, b.v) }; }
+static inline F4 floor(F4 a) { return { vrndmq_f32(a.v) }; }
+#else
+static inline F4 operator/(F4 a, F4 b) {
+    // Reciprocal estimate refined by two Newton-Raphson steps (~full float precision)
+    float32x4_t r = vrecpeq_f32(b.v);
+    r = vmulq_f32(r, vrecpsq_f32(b.v, r));
+    r = vmulq_f32(r, vrecpsq_f32(b.v, r));
+    return { vmulq_f32(a.v, r) };
+}
+static inline F4 floor(F4 a) {
+    float32x4_t t = vcvtq_f32_s32(vcvtq_s32_f32(a.v));     // truncate towards zero
+    return { vsubq_f32(t, vbslq_f32(vcgtq_f32(t, a.v), vdupq_n_f32(1.0f), vdupq_n_f32(0.0f))) };
+}
+#endif
+// 1/sqrt(a) for a > 0: estimate refined by two Newton-Raphson steps
+static inline F4 rsqrt(F4 a) {
+    float32x4_t e = vrsqrteq_f32(a.v);
+    e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(a.v, e), e));
+    e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(a.v, e), e));
+    return { e };
+}
+#else
+struct F4 { float v[4]; };
+struct M4 { bool v[4]; };
+
+#define SIMD_MAP(expr) F4 r; for (int k = 0; k < 4; k++) r.v[k] = (expr); return r
+static inline F4 splat(float a) { return { { a, a, a, a } }; }
+static inline F4 load(const float *p) { return { { p[0], p[1], p[2], p[3] } }; }
+static inline void store(float *p, F4 a) { memcpy(p, a.v, sizeof(a.v)); }
+static inline F4 operator+(F4 a, F4 b) { SIMD_MAP(a.v[k] + b.v[k]); }
+static inline F4 operator-(F4 a, F4 b) { SIMD_MAP(a.v[k] - b.v[k]); }
+static inline F4 operator*(F4 a, F4 b) { SIMD_MAP(a.v[k] * b.v[k]); }
+static inline F4 operator/(F4 a, F4 b) { SIMD_MAP(a.v[k] / b.v[k]); }
+static inline F4 operator-(F4 a) { SIMD_MAP(-a.v[k]); }
+static inline F4 min(F4 a, F4 b) { SIMD_MAP(b.v[k] < a.v[k] ? b.v[k] : a.v[k]); }
+static inline F4 max(F4 a, F4 b) { SIMD_MAP(a.v[k] < b.v[k] ? b.v[k] : a.v[k]); }
+static inline F4 abs(F4 a) { SIMD_MAP(fabsf(a.v[k])); }
+static inline F4 floor(F4 a) { SIMD_MAP(floorf(a.v[k])); }
+static inline F4 rsqrt(F4 a) { SIMD_MAP(1.0f / sqrtf(a.v[k])); }
+static inline M4 operator<(F4 a, F4 b) { M4 m; for (int k = 0; k < 4; k++) m.v[k] = a.v[k] < b.v[k]; return m; }
+static inline M4 operator>(F4 a, F4 b) { return b < a; }
+static inline M4 operator&(M4 a, M4 b) { M4 m; for (int k = 0; k < 4; k++) m.v[k] = a.v[k] && b.v[k]; return m; }
+static inline F4 select(M4 m, F4 a, F4 b) { SIMD_MAP(m.v[k] ? a.v[k] : b.v[k]); }
+#undef SIMD_MAP
+#endif
+
+static inline F4 operator+(F4 a, float b) { return a + splat(b); }
+static inline F4 operator-(F4 a, float b) { return a - splat(b); }
+static inline F4 operator*(F4 a, float b) { return a * splat(b); }
+static inline F4 operator-(float a, F4 b) { return splat(a) - b; }
+static inline F4 operator*(float a, F4 b) { return splat(a) * b; }
+static inline F4 clamp01(F4 a) { return min(max(a, splat(0.0f)), splat(1.0f)); }
+static inline F4 mix(F4 a, F4 b, F4 w) { return a + (b - a) * w; }
+
+// GLSL smoothstep(e0, e1, x) with per-lane edges
+static inline F4 smoothstep(F4 e0, F4 e1, F4 x) {
+    F4 t = clamp01((x - e0) / (e1 - e0));
+    return t * t * (3.0f - t * 2.0f);
+}
+
+/**
+ * sin(x): reduction to [-pi, pi] by the nearest multiple of 2*pi (split in
+ * two constants to keep precision for large x), folded into [-pi/2, pi/2],
+ * then the Taylor series to x^11 (error below 1e-7 there).
+ */
+static inline F4 sin(F4 x) {
+    const float PI = 3.14159265f, HALF_PI = 1.57079633f;
+    F4 q = floor(x * 0.159154943f + 0.5f);
+    F4 r = x - q * 6.28125f - q * 1.93530717e-3f;
+    r = select(r > splat(HALF_PI), PI - r, select(r < splat(-HALF_PI), -PI - r, r));
+    F4 r2 = r * r;
+    F4 p = splat(-2.50521084e-8f);
+    p = p * r2 + 2.75573192e-6f;
+    p = p * r2 - 1.98412698e-4f;
+    p = p * r2 + 8.33333333e-3f;
+    p = p * r2 - 1.66666667e-1f;
+    return r + r * r2 * p;
+}
+static inline F4 cos(F4 x) { return sin(x + 1.57079633f); }
+} // namespace simd
+
+// Per-frame inputs of the CPU renderer: the uniforms of the fragment shader
+struct CpuFrame {
+    float time = 0, age = 0, grayStart = 60, grayEnd = 70;
+    int geom = 0;
+    float width = 20, percent = 1;
+    float bg[3] = {}, el[3] = {};
+    const uint8_t *segTexels = nullptr;   // segments + 1 levels, as uploaded to u_segTex
+    const Layer *layer = nullptr;         // nlayers element layers (u_layerShape / u_layerColor)
+    int nlayers = 0;
+    int plasmaIter = PLASMA_ITER_FULL;    // PLASMA_ITER of the shader
+};
+
+// sdBox() / triangle() distance fields of the shader, without wobble
+static float box_sd(float x, float y, float b) {
+    const float dx = fabsf(x) - b, dy = fabsf(y) - b;
+    return sqrtf(std::max(dx, 0.0f) * std::max(dx, 0.0f) + std::max(dy, 0.0f) * std::max(dy, 0.0f))
+         + std::min(std::max(dx, dy), 0.0f);
+}
+
+static float triangle_sd(float x, float y, float r) {
+    const float k = sqrtf(3.0f);
+    float tx = fabsf(x) - r, ty = y + r / k;
+    if (tx + k * ty > 0.0f) { float ox = tx; tx = (tx - k * ty) / 2.0f; ty = (-k * ox - ty) / 2.0f; }
+    tx -= compat::clamp(tx, -2.0f * r, 0.0f);
+    return -sqrtf(tx * tx + ty * ty) * (ty > 0 ? 1.0f : ty < 0 ? -1.0f : 0.0f);
+}
+
+/**
+ * Evaluates the composite fragment shader (inline plasma background,
+ * geometry, arcMask, grayscale fade) on the CPU into a W x H RGBA buffer
+ * with the same layout glReadPixels produces, so the blit, pipeline and LUT
+ * paths are shared with the GPU renderer.
+ *
+ * init() rasterizes the strip geometry once to find each pixel's fragCoord
+ * and precomputes everything that only depends on it (polar angle, segment
+ * slot, distance fields). Per frame only the time-dependent terms are left:
+ * the plasma, the wobble and the shimmer, evaluated 4 pixels at a time.
+ * Row bands are spread over the shared WorkerPool.
+ */
+class CpuRenderer {
+public:
+    static const int BAND_ROWS = 4;
+
+    explicit CpuRenderer(WorkerPool &pool) : pool_(pool) {}
+
+    void init(const std::vector<GLfloat> &verts, const std::vector<GLfloat> &coords) {
+        const int n = W * H;
+        for (std::vector<float> *v : { &cx_, &cy_, &len_, &nx_, &ny_, &arc_, &segS_, &boxSd_, &triSd_, &xDist_ })
+            v->assign(n, 0.0f);
+        segIdx_.assign(n, 0);
+        covered_.assign(n, 0);
+
+        // Triangle strip rasterization at pixel centers (affine varyings, w = 1)
+        for (size_t t = 0; t + 2 < verts.size() / 3; t++) {
+            float px[3], py[3], u[3], v[3];
+            for (int k = 0; k < 3; k++) {
+                px[k] = (verts[(t + k) * 3] + 1.0f) * 0.5f * W;
+                py[k] = (verts[(t + k) * 3 + 1] + 1.0f) * 0.5f * H;
+                u[k] = coords[(t + k) * 2]; v[k] = coords[(t + k) * 2 + 1];
+            }
+            float area = (px[1] - px[0]) * (py[2] - py[0]) - (px[2] - px[0]) * (py[1] - py[0]);
+            if (fabsf(area) < 1e-6f) continue;      // degenerate join
+            int x0 = std::max(0, (int)floorf(std::min({px[0], px[1], px[2]})));
+            int x1 = std::min(W - 1, (int)ceilf(std::max({px[0], px[1], px[2]})));
+            int y0 = std::max(0, (int)floorf(std::min({py[0], py[1], py[2]})));
+            int y1 = std::min(H - 1, (int)ceilf(std::max({py[0], py[1], py[2]})));
+            for (int y = y0; y <= y1; y++) {
+                for (int x = x0; x <= x1; x++) {
+                    const float sx = x + 0.5f, sy = y + 0.5f;
+                    float b1 = ((sx - px[0]) * (py[2] - py[0]) - (px[2] - px[0]) * (sy - py[0])) / area;
+                    float b2 = ((px[1] - px[0]) * (sy - py[0]) - (sx - px[0]) * (py[1] - py[0])) / area;
+                    float b0 = 1.0f - b1 - b2;
+                    const float EPS = -1e-5f;
+                    const int i = y * W + x;
+                    if (b0 < EPS || b1 < EPS || b2 < EPS || covered_[i]) continue;
+                    covered_[i] = 1;
+                    // coords = fragCoord * 0.5, as at the top of main()
+                    cx_[i] = (b0 * u[0] + b1 * u[1] + b2 * u[2]) * 0.5f;
+                    cy_[i] = (b0 * v[0] + b1 * v[1] + b2 * v[2]) * 0.5f;
+                }
+            }
+        }
+
+        for (int i = 0; i < n; i++) {
+            const float x = cx_[i], y = cy_[i];
+            len_[i] = sqrtf(x * x + y * y);
+            nx_[i] = len_[i] > 0 ? x / len_[i] : 0.0f;
+            ny_[i] = len_[i] > 0 ? y / len_[i] : 0.0f;
+            const float a = atan2f(y, x);
+            arc_[i] = (a + 3.14159265f) / 6.28318530f;
+            const float phi = (a + 3.14159f) / 3.14159f * g_cfg.segments * 0.5f;
+            const float fi = floorf(phi), s = phi - fi;
+            segIdx_[i] = (uint8_t)((int)fmodf(fi, (float)g_cfg.segments));
+            segS_[i] = s * s * (3.0f - 2.0f * s);
+
+            boxSd_[i] = box_sd(x, y, 0.22f);
+            triSd_[i] = triangle_sd(x, y, 0.25f);
+
+            xDist_[i] = fabsf(fabsf(x) - fabsf(y));
+        }
+    }
+
+    int threads() const { return pool_.threads(); }
+
+    void render(const CpuFrame &f, unsigned char *rgba) {
+        const int bands = (H + BAND_ROWS - 1) / BAND_ROWS;
+        pool_.run(bands, [&](int b) {
+            render_rows(f, b * BAND_ROWS, std::min(H, (b + 1) * BAND_ROWS), rgba);
+        });
+    }
+
+private:
+    void render_rows(const CpuFrame &f, int y0, int y1, unsigned char *rgba) const {
+        using namespace simd;
+
+        // Per-frame scalars (uniform expressions of the shader)
+        float tin[PLASMA_ITER_FULL];
+        const int iters = std::min(f.plasmaIter, PLASMA_ITER_FULL);
+        for (int n = 0; n < iters; n++) tin[n] = f.time * (0.7f - (0.2f / float(n + 1)));
+        const float shiftT = sinf(f.time * 0.5f);
+        const bool teal = f.bg[2] > 0.5f && f.bg[0] < 0.3f;
+        const bool fullArc = f.percent >= FULL_ARC_PERCENT;
+        const float width01 = compat::clamp(f.width / 100.0f, 0.0f, 1.0f);
+        const float widthActive = 0.003f + (0.08f - 0.003f) * width01;
+        const float edge = 0.01f + (0.08f - 0.01f) * width01;
+        float fade = compat::clamp((f.age - f.grayStart) / (f.grayEnd - f.grayStart), 0.0f, 1.0f);
+        fade = fade * fade * (3.0f - 2.0f * fade);
+        const F4 t2 = splat(f.time * 2.0f), pct = splat(f.percent), zero = splat(0.0f), one = splat(1.0f);
+
+        for (int i = y0 * W; i < y1 * W; i += 4) {
+            const F4 cx = load(&cx_[i]), cy = load(&cy_[i]);
+
+            // --- Magic Shine background
+            const F4 px = cx * 10.0f - 19.0f, py = cy * 10.0f - 19.0f;
+            F4 ix = px, iy = py, c = one;
+            for (int n = 0; n < iters; n++) {
+                const F4 T = splat(tin[n]);
+                const F4 nix = px + cos(T - ix) + sin(T + iy);
+                const F4 niy = py + sin(T - iy) + cos(T + ix);
+                ix = nix; iy = niy;
+                // 1 / length(p.x / (2 sin(ix + T) / inten), p.y / (cos(iy + T) / inten)), scaled by s1 * s2 to avoid the divisions
+                const F4 s1 = sin(ix + T), s2 = cos(iy + T);
+                const F4 a = px * s2 * 0.025f, b = py * s1 * 0.05f;
+                c = c + abs(s1 * s2) * rsqrt(max(a * a + b * b, splat(1e-30f)));
+            }
+            c = 1.5f - abs(c * (1.0f / float(iters)));
+            const F4 c4 = c * c * c * c;
+            const F4 shift = (cx + cy + shiftT) * 0.5f;
+            F4 r = sin(shift * 3.14f) * 0.10f + f.bg[0];
+            F4 g = cos(shift * 3.14f) * 0.10f + f.bg[1];
+            F4 bl = sin(shift * 6.28f) * 0.10f + f.bg[2];
+            if (teal) {
+                g = clamp01(cx + 0.4f) * 1.1f;
+                bl = bl * 0.8f;
+            }
+            r = r * c4; g = g * c4; bl = bl * c4;
+
+            // --- Geometry
+            float segf[4];
+            for (int k = 0; k < 4; k++) {
+                const uint8_t *tex = f.segTexels + segIdx_[i + k];
+                segf[k] = (tex[0] + (tex[1] - tex[0]) * segS_[i + k]) * (1.0f / 255.0f);
+            }
+            const F4 wob = (sin(load(&ny_[i]) * 5.0f + t2) - sin(load(&nx_[i]) * 5.0f + t2)) * 0.01f;
+            const F4 len = load(&len_[i]);
+            F4 pmask = one;
+            if (!fullArc) {
+                const F4 angle = load(&arc_[i]);
+                pmask = smoothstep(zero, splat(0.03f), angle) * smoothstep(pct + 0.03f, pct - 0.03f, angle);
+            }
+            const F4 baseWidth = (widthActive - 0.01f) * pmask + 0.01f;
+            const F4 w = baseWidth + baseWidth * load(segf) * pmask * 0.1f;
+            F4 shape;
+            switch (f.geom) {
+            case 0: {
+                const F4 fr = len + wob;
+                shape = smoothstep(0.25f - w, splat(0.25f), fr) - smoothstep(splat(0.25f), w + 0.25f, fr);
+                break;
+            }
+            case 1:
+                shape = (1.0f - smoothstep(splat(0.25f - edge), splat(0.25f + edge), len + wob)) * pmask;
+                break;
+            case 2: shape = smoothstep(w, zero, abs(load(&boxSd_[i]) + wob)); break;
+            case 3: shape = smoothstep(w, zero, abs(load(&triSd_[i]) + wob)); break;
+            default:
+                shape = select((load(&xDist_[i]) + wob * pmask < w) & (len < splat(0.3f)), one, zero);
+                break;
+            }
+            shape = clamp01(shape);
+
+            // --- Grayscale fade of the background, element composited in front
+            const F4 gray = r * 0.3f + g * 0.59f + bl * 0.11f, fd = splat(fade);
+            float out[3][4];
+            store(out[0], mix(mix(r, gray, fd), splat(f.el[0]), shape));
+            store(out[1], mix(mix(g, gray, fd), splat(f.el[1]), shape));
+            store(out[2], mix(mix(bl, gray, fd), splat(f.el[2]), shape));
+            if (f.nlayers > 0) {
+                float wobs[4];
+                store(wobs, wob);
+                for (int k = 0; k < 4; k++) {
+                    for (int l = 0; l < f.nlayers; l++) {
+                        const float a = compat::clamp(layer_shape(f.layer[l], i + k, wobs[k], segf[k]), 0.0f, 1.0f);
+                        for (int ch = 0; ch < 3; ch++) out[ch][k] += (f.layer[l].colorRGB[ch] - out[ch][k]) * a;
+                    }
+                }
+            }
+            for (int k = 0; k < 4; k++) {
+                unsigned char *dst = rgba + (size_t)(i + k) * 4;
+                for (int ch = 0; ch < 3; ch++)
+                    dst[ch] = covered_[i + k] ? (unsigned char)(compat::clamp(out[ch][k], 0.0f, 1.0f) * 255.0f + 0.5f) : 0;
+                dst[3] = 255;
+            }
+        }
+    }
+
+    // layerShape() of the shader for pixel i; layers depend on their radius, so nothing is precomputed
+    float layer_shape(const Layer &l, int i, float wob, float segf) const {
+        const float x = cx_[i], y = cy_[i], len = len_[i];
+        const float r = l.radius / 200.0f;
+        const float width01 = compat::clamp(l.width / 100.0f, 0.0f, 1.0f);
+        auto smooth = [](float e0, float e1, float v) {
+            float t = compat::clamp((v - e0) / (e1 - e0), 0.0f, 1.0f);
+            return t * t * (3.0f - 2.0f * t);
+        };
+        float pmask = 1.0f;
+        if (l.percent < FULL_ARC_PERCENT)
+            pmask = smooth(0.0f, 0.03f, arc_[i]) * smooth(l.percent + 0.03f, l.percent - 0.03f, arc_[i]);
+        const float baseWidth = 0.01f + (0.003f + (0.08f - 0.003f) * width01 - 0.01f) * pmask;
+        const float w = baseWidth + baseWidth * segf * pmask * 0.1f;
+        switch (l.geometryMode) {
+        case 0: return smooth(r - w, r, len + wob) - smooth(r, r + w, len + wob);
+        case 1: {
+            const float edge = 0.01f + (0.08f - 0.01f) * width01;
+            return (1.0f - smooth(r - edge, r + edge, len + wob)) * pmask;
+        }
+        case 2: return smooth(w, 0.0f, fabsf(box_sd(x, y, r * 0.88f) + wob));
+        case 3: return smooth(w, 0.0f, fabsf(triangle_sd(x, y, r) + wob));
+        default: return (xDist_[i] + wob * pmask < w && len < r * 1.2f) ? 1.0f : 0.0f;
+        }
+    }
+
+    std::vector<float> cx_, cy_, len_, nx_, ny_, arc_, segS_, boxSd_, triSd_, xDist_;
+    std::vector<uint8_t> segIdx_, covered_;
+    WorkerPool &pool_;
+};
+
+// =======================================================
+// PIPELINED READBACK (render thread -> copy thread)
+// =======================================================
+/**
+ * Two host frame buffers handed between the render thread and the copy thread.
+ *
+ * The render thread fills a free slot with glReadPixels and submits it; the
+ * copy thread takes ready slots in order, pushes them into the FrameCanvas,
+ * waits for SwapOnVSync and releases them again. With only two slots the
+ * render thread blocks when the copy thread falls behind, so the pipeline
+ * stays paced by the matrix instead of queueing stale frames.
+ */
+struct FrameSlot {
+    std::vector<unsigned char> pixels;
+    bool blank = false;   // long-term signal loss: clear instead of copying
+    uint32_t seq = 0;     // render loop frame the pixels belong to (for capture)
+};
+
+class FramePipeline {
+public:
+    explicit FramePipeline(size_t frameBytes) {
+        for (int i = 0; i < 2; i++) { slots_[i].pixels.resize(frameBytes); free_[i] = true; }
+    }
+
+    // Render thread: returns a slot to fill, or nullptr after shutdown().
+    FrameSlot *acquire_free() {
+        std::unique_lock<std::mutex> lk(mtx_);
+        cv_.wait(lk, [&]{ return stop_ || free_[0] || free_[1]; });
+        if (stop_) return nullptr;
+        int i = free_[0] ? 0 : 1;
+        free_[i] = false;
+        return &slots_[i];
+    }
+
+    void submit(FrameSlot *slot) {
+        { std::lock_guard<std::mutex> lk(mtx_); ready_[nready_++] = index_of(slot); }
+        cv_.notify_all();
+    }
+
+    // Copy thread: returns the oldest submitted slot, or nullptr once shutdown() was called and all are drained.
+    FrameSlot *acquire_ready() {
+        std::unique_lock<std::mutex> lk(mtx_);
+        cv_.wait(lk, [&]{ return stop_ || nready_ > 0; });
+        if (nready_ == 0) return nullptr;
+        int i = ready_[0];
+        ready_[0] = ready_[1]; nready_--;
+        return &slots_[i];
+    }
+
+    void release(FrameSlot *slot) {
+        { std::lock_guard<std::mutex> lk(mtx_); free_[index_of(slot)] = true; }
+        cv_.notify_all();
+    }
+
+    void shutdown() {
+        { std::lock_guard<std::mutex> lk(mtx_); stop_ = true; }
+        cv_.notify_all();
+    }
+
+private:
+    int index_of(const FrameSlot *slot) const { return (slot == &slots_[0]) ? 0 : 1; }
+
+    FrameSlot slots_[2];
+    bool free_[2];
+    int ready_[2] = {0, 0};
+    int nready_ = 0;
+    bool stop_ = false;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+};
+
+// =======================================================
+// FRAME CAPTURE
+// =======================================================
+/**
+ * Opt-in recording of the post-readback frames (capture=PATH), e.g. to
+ * compare shader changes pixel for pixel against a known-good build.
+ *
+ * Whoever hands a frame to the canvas offers it here: the copy thread when
+ * pipelined, otherwise the render thread. offer() copies the frame into one
+ * of QUEUE_FRAMES preallocated slots and returns; a writer thread appends
+ * the slots to the file. When every slot is still waiting for the writer
+ * (slow SD card) the frame is dropped and counted, never waited for. Frames
+ * carry the render loop frame number, so gaps from drops stay visible.
+ *
+ * File layout (host byte order, little endian on the Pi):
+ *   CaptureHeader, then per frame a CaptureFrameHeader followed by
+ *   width * height * bpp pixel bytes in glReadPixels layout (bottom-up rows
+ *   in readback column order; FLAG_MATRIX_ORDER: already in matrix order).
+ *
+ * An inspect callback (optional, set before open()) sees every frame on the
+ * writer thread as well; the benchmark build compares frames with it.
+ */
+struct CaptureHeader {
+    char magic[8];          // "LEDCAP01"
+    uint32_t width, height;
+    uint32_t bpp;           // 3 (GL_RGB) or 4 (GL_RGBA)
+    uint32_t flags;
+};
+struct CaptureFrameHeader {
+    uint32_t seq;           // render loop frame number
+    uint32_t reserved;
+    uint64_t timeUs;        // CLOCK_MONOTONIC when the frame was offered
+};
+static_assert(sizeof(CaptureHeader) == 24 && sizeof(CaptureFrameHeader) == 16, "capture file layout");
+static const char CAPTURE_MAGIC[8] = { 'L', 'E', 'D', 'C', 'A', 'P', '0', '1' };
+
+class FrameCapture {
+public:
+    static const int QUEUE_FRAMES = 8;
+    static const uint32_t FLAG_MATRIX_ORDER = 1;
+
+    std::function<void(const unsigned char *pixels, uint32_t seq)> inspect;
+
+    ~FrameCapture() { close(); }
+
+    // Starts the writer; path may be empty to only run `inspect`. maxFrames 0: no limit.
+    bool open(const std::string &path, int width, int height, int bpp, uint32_t flags, uint64_t maxFrames) {
+        if (!path.empty()) {
+            file_ = fopen(path.c_str(), "wb");
+            if (!file_) { log_ts("CAPTURE: Cannot open " + path + ": " + strerror(errno)); return false; }
+            setvbuf(file_, nullptr, _IOFBF, 1 << 20);
+            CaptureHeader h;
+            memcpy(h.magic, CAPTURE_MAGIC, sizeof(h.magic));
+            h.width = width; h.height = height; h.bpp = bpp; h.flags = flags;
+            fwrite(&h, sizeof(h), 1, file_);
+        }
+        frameBytes_ = (size_t)width * height * bpp;
+        bpp_ = bpp;
+        maxFrames_ = maxFrames;
+        for (Slot &sl : slots_) sl.pixels.resize(frameBytes_);
+        for (int i = 0; i < QUEUE_FRAMES; i++) free_.push_back(i);
+        writer_ = std::thread([this] { write_loop(); });
+        return true;
+    }
+
+    bool active() const { return writer_.joinable(); }
+    int bpp() const { return bpp_; }
+
+    // Producer (one thread at a time): queue a copy of the frame, or drop it
+    void offer(const unsigned char *pixels, uint32_t seq) {
+        if (!active() || (maxFrames_ && offered_ >= maxFrames_)) return;
+        int i;
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            if (free_.empty()) { dropped_++; return; }
+            i = free_.back();
+            free_.pop_back();
+        }
+        offered_++;
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        slots_[i].hdr.seq = seq;
+        slots_[i].hdr.reserved = 0;
+        slots_[i].hdr.timeUs = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+        memcpy(slots_[i].pixels.data(), pixels, frameBytes_);
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            queue_.push_back(i);
+        }
+        cv_.notify_one();
+    }
+
+    // Writes out what is queued, then stops the writer and closes the file
+    void close() {
+        if (!active()) return;
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        writer_.join();
+        if (!file_) return;             // inspect only (golden comparison), nothing was written
+        fclose(file_);
+        file_ = nullptr;
+        log_ts("CAPTURE: " + std::to_string(written()) + " frame(s) written, " + std::to_string(dropped()) + " dropped");
+    }
+
+    uint64_t written() const { return written_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot {
+        CaptureFrameHeader hdr;
+        std::vector<unsigned char> pixels;
+    };
+
+    void write_loop() {
+        std::unique_lock<std::mutex> lk(mtx_);
+        for (;;) {
+            cv_.wait(lk, [this] { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) return;     // stopped and drained
+            int i = queue_.front();
+            queue_.pop_front();
+            lk.unlock();
+            const Slot &sl = slots_[i];
+            if (file_ && !failed_) {
+                if (fwrite(&sl.hdr, sizeof(sl.hdr), 1, file_) != 1 || fwrite(sl.pixels.data(), 1, frameBytes_, file_) != frameBytes_) {
+                    log_ts(std::string("CAPTURE: Write failed, recording stopped: ") + strerror(errno));
+                    failed_ = true;
+                }
+            }
+            if (inspect) inspect(sl.pixels.data(), sl.hdr.seq);
+            written_.fetch_add(1, std::memory_order_relaxed);
+            lk.lock();
+            free_.push_back(i);
+        }
+    }
+
+    Slot slots_[QUEUE_FRAMES];
+    std::vector<int> free_;
+    std::deque<int> queue_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::thread writer_;
+    FILE *file_ = nullptr;
+    size_t frameBytes_ = 0;
+    int bpp_ = 0;
+    uint64_t maxFrames_ = 0, offered_ = 0;
+    bool stop_ = false, failed_ = false;
+    std::atomic<uint64_t> written_{0}, dropped_{0};
+};
+
+static FrameCapture g_capture;
+
+// =======================================================
+// JPEG ENCODER (preview stream)
+// =======================================================
+/**
+ * Minimal baseline JPEG encoder for the preview stream: 4:4:4 YCbCr (no
+ * chroma subsampling, the LED content is mostly saturated colour edges),
+ * the standard Annex K quantization tables scaled IJG-style by `quality`,
+ * and the standard Huffman tables. Preview frames are a few thousand pixels,
+ * so a straightforward separable float DCT is plenty.
+ */
+namespace jpeg {
+static const uint8_t ZIGZAG[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+static const uint8_t LUMA_Q[64] = {
+    16, 11, 10, 16, 24, 40, 51, 61,  12, 12, 14, 19, 26, 58, 60, 55,
+    14, 13, 16, 24, 40, 57, 69, 56,  14, 17, 22, 29, 51, 87, 80, 62,
+    18, 22, 37, 56, 68,109,103, 77,  24, 35, 55, 64, 81,104,113, 92,
+    49, 64, 78, 87,103,121,120,101,  72, 92, 95, 98,112,100,103, 99
+};
+static const uint8_t CHROMA_Q[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99,  18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,  47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,  99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,  99, 99, 99, 99, 99, 99, 99, 99
+};
+
+// Huffman tables as code counts per length (1..16) followed by the symbols
+static const uint8_t DC_LUMA_COUNTS[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const uint8_t DC_CHROMA_COUNTS[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const uint8_t DC_SYMBOLS[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+static const uint8_t AC_LUMA_COUNTS[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+static const uint8_t AC_LUMA_SYMBOLS[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+static const uint8_t AC_CHROMA_COUNTS[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const uint8_t AC_CHROMA_SYMBOLS[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+// Canonical Huffman code per symbol
+struct HuffTable {
+    uint16_t code[256] = {};
+    uint8_t len[256] = {};
+    HuffTable(const uint8_t counts[16], const uint8_t *symbols) {
+        uint16_t c = 0;
+        for (int l = 1, k = 0; l <= 16; l++, c <<= 1)
+            for (int i = 0; i < counts[l - 1]; i++, k++, c++) { code[symbols[k]] = c; len[symbols[k]] = (uint8_t)l; }
+    }
+};
+
+class BitWriter {
+public:
+    explicit BitWriter(std::string &out) : out_(out) {}
+    void put(uint32_t bits, int n) {
+        acc_ = (acc_ << n) | (bits & ((1u << n) - 1));
+        n_ += n;
+        while (n_ >= 8) {
+            uint8_t b = (uint8_t)(acc_ >> (n_ - 8));
+            out_ += (char)b;
+            if (b == 0xff) out_ += '\0';    // byte stuffing
+            n_ -= 8;
+        }
+    }
+    void flush() { if (n_ > 0) put(0x7f, 8 - n_); }   // pad with 1 bits
+
+private:
+    std::string &out_;
+    uint32_t acc_ = 0;
+    int n_ = 0;
+};
+
+static void put_marker(std::string &out, uint8_t marker, uint16_t len) {
+    out += (char)0xff; out += (char)marker;
+    out += (char)(len >> 8); out += (char)(len & 0xff);
+}
+
+static void put_huffman(std::string &out, uint8_t cls, const uint8_t counts[16], const uint8_t *symbols) {
+    int n = 0;
+    for (int i = 0; i < 16; i++) n += counts[i];
+    put_marker(out, 0xc4, (uint16_t)(2 + 1 + 16 + n));
+    out += (char)cls;
+    out.append((const char *)counts, 16);
+    out.append((const char *)symbols, n);
+}
+
+// Number of bits of |v| and its JPEG magnitude code
+static inline int magnitude(int v, uint32_t &bits) {
+    int a = v < 0 ? -v : v, n = 0;
+    while (a) { n++; a >>= 1; }
+    bits = (uint32_t)(v < 0 ? v - 1 : v);
+    return n;
+}
+
+// Forward DCT, quantization and entropy coding of one 8x8 block; returns its DC value
+static int encode_block(BitWriter &bw, const float in[64], const float qdiv[64], int prevDc,
+                        const HuffTable &dc, const HuffTable &ac) {
+    static float cosTab[8][8];
+    static bool init = false;
+    if (!init) {
+        for (int u = 0; u < 8; u++)
+            for (int x = 0; x < 8; x++)
+                cosTab[u][x] = (u ? 0.5f : 0.35355339f) * cosf((2 * x + 1) * u * 3.14159265f / 16);
+        init = true;
+    }
+    float tmp[64], coef[64];
+    for (int y = 0; y < 8; y++)
+        for (int u = 0; u < 8; u++) {
+            float sum = 0;
+            for (int x = 0; x < 8; x++) sum += in[y * 8 + x] * cosTab[u][x];
+            tmp[y * 8 + u] = sum;
+        }
+    for (int v = 0; v < 8; v++)
+        for (int u = 0; u < 8; u++) {
+            float sum = 0;
+            for (int y = 0; y < 8; y++) sum += tmp[y * 8 + u] * cosTab[v][y];
+            coef[v * 8 + u] = sum;
+        }
+
+    int q[64];
+    for (int i = 0; i < 64; i++) q[i] = (int)lrintf(coef[ZIGZAG[i]] * qdiv[ZIGZAG[i]]);
+
+    uint32_t bits;
+    int n = magnitude(q[0] - prevDc, bits);
+    bw.put(dc.code[n], dc.len[n]);
+    if (n) bw.put(bits, n);
+
+    int run = 0;
+    for (int i = 1; i < 64; i++) {
+        if (q[i] == 0) { run++; continue; }
+        for (; run >= 16; run -= 16) bw.put(ac.code[0xf0], ac.len[0xf0]);   // ZRL
+        n = magnitude(q[i], bits);
+        const int sym = (run << 4) | n;
+        bw.put(ac.code[sym], ac.len[sym]);
+        bw.put(bits, n);
+        run = 0;
+    }
+    if (run) bw.put(ac.code[0x00], ac.len[0x00]);   // EOB
+    return q[0];
+}
+
+// Encodes a tightly packed w x h RGB image (top row first); quality 1..100
+static std::string encode(const uint8_t *rgb, int w, int h, int quality) {
+    static const HuffTable dcLuma(DC_LUMA_COUNTS, DC_SYMBOLS), dcChroma(DC_CHROMA_COUNTS, DC_SYMBOLS);
+    static const HuffTable acLuma(AC_LUMA_COUNTS, AC_LUMA_SYMBOLS), acChroma(AC_CHROMA_COUNTS, AC_CHROMA_SYMBOLS);
+
+    quality = compat::clamp(quality, 1, 100);
+    const int scale = quality < 50 ? 5000 / quality : 200 - 2 * quality;
+    uint8_t qt[2][64];
+    float qdiv[2][64];
+    for (int i = 0; i < 64; i++) {
+        qt[0][i] = (uint8_t)compat::clamp((LUMA_Q[i] * scale + 50) / 100, 1, 255);
+        qt[1][i] = (uint8_t)compat::clamp((CHROMA_Q[i] * scale + 50) / 100, 1, 255);
+        qdiv[0][i] = 1.0f / qt[0][i];
+        qdiv[1][i] = 1.0f / qt[1][i];
+    }
+
+    std::string out;
+    out.reserve(4096);
+    out += (char)0xff; out += (char)0xd8;                       // SOI
+    put_marker(out, 0xe0, 16);                                  // APP0 JFIF 1.1, no density
+    out.append("JFIF\0\x01\x01\0\0\x01\0\x01\0\0", 14);
+    for (int t = 0; t < 2; t++) {                               // DQT, zigzag order
+        put_marker(out, 0xdb, 67);
+        out += (char)t;
+        for (int i = 0; i < 64; i++) out += (char)qt[t][ZIGZAG[i]];
+    }
+    put_marker(out, 0xc0, 17);                                  // SOF0: 8 bit, 3 components, 1x1 sampling
+    out += (char)8;
+    out += (char)(h >> 8); out += (char)(h & 0xff);
+    out += (char)(w >> 8); out += (char)(w & 0xff);
+    out += (char)3;
+    for (int c = 0; c < 3; c++) { out += (char)(c + 1); out += (char)0x11; out += (char)(c ? 1 : 0); }
+    put_huffman(out, 0x00, DC_LUMA_COUNTS, DC_SYMBOLS);
+    put_huffman(out, 0x10, AC_LUMA_COUNTS, AC_LUMA_SYMBOLS);
+    put_huffman(out, 0x01, DC_CHROMA_COUNTS, DC_SYMBOLS);
+    put_huffman(out, 0x11, AC_CHROMA_COUNTS, AC_CHROMA_SYMBOLS);
+    put_marker(out, 0xda, 12);                                  // SOS
+    out += (char)3;
+    for (int c = 0; c < 3; c++) { out += (char)(c + 1); out += (char)(c ? 0x11 : 0x00); }
+    out += (char)0; out += (char)63; out += (char)0;
+
+    BitWriter bw(out);
+    int dc[3] = {0, 0, 0};
+    float blk[3][64];
+    for (int by = 0; by < h; by += 8) {
+        for (int bx = 0; bx < w; bx += 8) {
+            for (int y = 0; y < 8; y++) {
+                for (int x = 0; x < 8; x++) {
+                    // Edge blocks repeat the last row/column
+                    const uint8_t *p = rgb + ((size_t)std::min(by + y, h - 1) * w + std::min(bx + x, w - 1)) * 3;
+                    const float r = p[0], g = p[1], b = p[2];
+                    blk[0][y * 8 + x] = 0.299f * r + 0.587f * g + 0.114f * b - 128.0f;
+                    blk[1][y * 8 + x] = -0.168736f * r - 0.331264f * g + 0.5f * b;
+                    blk[2][y * 8 + x] = 0.5f * r - 0.418688f * g - 0.081312f * b;
+                }
+            }
+            dc[0] = encode_block(bw, blk[0], qdiv[0], dc[0], dcLuma, acLuma);
+            dc[1] = encode_block(bw, blk[1], qdiv[1], dc[1], dcChroma, acChroma);
+            dc[2] = encode_block(bw, blk[2], qdiv[1], dc[2], dcChroma, acChroma);
+        }
+    }
+    bw.flush();
+    out += (char)0xff; out += (char)0xd9;                       // EOI
+    return out;
+}
+} // namespace jpeg
+
+// =======================================================
+// THERMAL TIERS
+// =======================================================
+/**
+ * Steps the cube down before the SoC gets hot enough for the firmware to
+ * throttle it: a throttled CPU starves the matrix refresh thread and the
+ * panels flicker.
+ *
+ * A monitor thread reads the SoC temperature and the firmware's throttle
+ * flags every THERMAL_POLL_SEC. The tier rises as soon as its threshold is
+ * crossed. It falls one step at a time, once the temperature is
+ * THERMAL_HYST_C below the current tier's threshold and the tier has held
+ * for THERMAL_HOLD_SEC. Current throttling or under-voltage forces at least
+ * THERMAL_TIER_THROTTLED.
+ *
+ * Each tier caps the frame rate; the governor still adapts below the cap
+ * to the measured frame cost. From hot on, the plasma runs
+ * PLASMA_ITER_CHEAP iterations instead of PLASMA_ITER_FULL, on either
+ * renderer and at any bg-scale. Tiers also refresh the low-resolution
+ * background less often (bg-scale > 1 only) and dim the panels. Dropping
+ * PWM bits shortens the refresh thread's bit-plane loop.
+ */
+struct ThermalTier {
+    const char *name;
+    float  belowLimitC;     // entered at thermal-limit minus this
+    double fpsScale;        // of the configured fps
+    int    bgIntervalMul;   // background refresh interval multiplier
+    bool   cheapPlasma;     // PLASMA_ITER_CHEAP plasma iterations
+    int    brightness;      // percent of the configured brightness
+    int    pwmBitsDrop;     // PWM bits below the configured depth
+};
+static const ThermalTier THERMAL_TIERS[] = {
+    { "normal",   1e9f,  1.0,       1, false, 100, 0 },
+    { "warm",     10.0f, 0.75,      2, false, 100, 0 },
+    { "hot",      5.0f,  0.5,       4, true,   80, 1 },
+    { "critical", 0.0f,  1.0 / 3.0, 4, true,   60, 2 },
+};
+static const int THERMAL_NUM_TIERS = sizeof(THERMAL_TIERS) / sizeof(THERMAL_TIERS[0]);
+static const int THERMAL_TIER_THROTTLED = 2;
+static const int THERMAL_POLL_SEC = 2;
+static const float THERMAL_HYST_C = 3.0f;
+static const double THERMAL_HOLD_SEC = 30.0;
+static const char *const THERMAL_TEMP_PATH = "/sys/class/thermal/thermal_zone0/temp";
+static const char *const THERMAL_THROTTLE_PATH = "/sys/devices/platform/soc/soc:firmware/get_throttled";
+static const uint32_t THROTTLE_NOW_MASK = 0xF;     // under-voltage, freq capped, throttled, soft temp limit (now)
+
+static std::atomic<int> g_thermalTier{0};          // written by the monitor thread
+static std::atomic<int> g_socTempMilli{0};
+static std::atomic<uint32_t> g_socThrottled{0};
+static std::atomic<uint64_t> g_thermalChanges{0};
+static std::atomic<bool> g_thermalActive{false};   // a sensor was found
+static uint8_t g_baseBrightness = 100, g_basePwmBits = 11;     // the matrix settings, set once in main()
+
+// Tier hysteresis (see above); pure, so the monitor thread owns one instance
+class ThermalTiers {
+public:
+    explicit ThermalTiers(float limitC) : limit_(limitC) {}
+
+    int tier() const { return tier_; }
+
+    /** Feeds one reading; returns true when the tier changed. */
+    bool update(float tempC, uint32_t throttled, double now) {
+        int raw = 0;
+        for (int t = THERMAL_NUM_TIERS - 1; t > 0 && !raw; t--)
+            if (tempC >= threshold(t)) raw = t;
+        if (throttled & THROTTLE_NOW_MASK) raw = std::max(raw, THERMAL_TIER_THROTTLED);
+
+        const int prev = tier_;
+        if (raw > tier_) tier_ = raw;
+        else if (raw < tier_ && now - changed_ >= THERMAL_HOLD_SEC && tempC < threshold(tier_) - THERMAL_HYST_C) tier_--;
+        if (tier_ == prev) return false;
+        changed_ = now;
+        return true;
+    }
+
+private:
+    float threshold(int t) const { return limit_ - THERMAL_TIERS[t].belowLimitC; }
+
+    float limit_;
+    int tier_ = 0;
+    double changed_ = -1e9;
+};
+
+static bool read_sysfs_u32(const char *path, int base, uint32_t &out) {
+    FILE *f = fopen(path, "r");
+    if (!f) return false;
+    char buf[32] = {};
+    bool ok = fgets(buf, sizeof(buf), f) != nullptr;
+    fclose(f);
+    char *end = nullptr;
+    unsigned long v = ok ? strtoul(buf, &end, base) : 0;
+    if (!ok || end == buf) return false;
+    out = (uint32_t)v;
+    return true;
+}
+
+// Dims and reduces the PWM depth of a canvas to the current tier; takes effect as pixels are set
+static void apply_thermal_output(FrameCanvas *canvas) {
+    const ThermalTier &t = THERMAL_TIERS[g_thermalTier.load(std::memory_order_relaxed)];
+    const uint8_t brightness = (uint8_t)std::max(1, g_baseBrightness * t.brightness / 100);
+    const uint8_t pwmBits = (uint8_t)std::max(1, g_basePwmBits - t.pwmBitsDrop);
+    if (canvas->brightness() != brightness) canvas->SetBrightness(brightness);
+    if (canvas->pwmbits() != pwmBits) canvas->SetPWMBits(pwmBits);
+}
+
+void startThermalMonitor() {
+    uint32_t milli = 0, throttled = 0;
+    if (!read_sysfs_u32(THERMAL_TEMP_PATH, 10, milli)) {
+        log_ts("THERMAL: No SoC temperature sensor, tiers disabled");
+        return;
+    }
+    const bool haveFlags = read_sysfs_u32(THERMAL_THROTTLE_PATH, 16, throttled);
+    g_thermalActive = true;
+    log_ts("THERMAL: Tiers from " + fmt_float(g_cfg.thermalLimit - THERMAL_TIERS[1].belowLimitC, 1) + " C, limit "
+           + fmt_float(g_cfg.thermalLimit, 1) + " C" + (haveFlags ? ", firmware throttle flags" : ""));
+
+    ThermalTiers tiers(g_cfg.thermalLimit);
+    auto start = std::chrono::steady_clock::now();
+    int polls = 0;
+    while (!interrupt_received) {
+        if (polls-- <= 0) {
+            polls = THERMAL_POLL_SEC * 5;
+            if (read_sysfs_u32(THERMAL_TEMP_PATH, 10, milli)) g_socTempMilli = (int)milli;
+            if (haveFlags && read_sysfs_u32(THERMAL_THROTTLE_PATH, 16, throttled)) g_socThrottled = throttled;
+            const double now = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            const float tempC = g_socTempMilli.load() / 1000.0f;
+            if (tiers.update(tempC, g_socThrottled.load(), now)) {
+                const ThermalTier &t = THERMAL_TIERS[tiers.tier()];
+                g_thermalTier = tiers.tier();
+                g_thermalChanges++;
+                char flags[16];
+                snprintf(flags, sizeof(flags), "0x%x", g_socThrottled.load());
+                log_ts("THERMAL: " + fmt_float(tempC, 1) + " C, throttled " + flags + ", tier " + t.name
+                       + " (fps x" + fmt_float((float)t.fpsScale, 2) + ", brightness " + std::to_string(t.brightness)
+                       + "%, pwm -" + std::to_string(t.pwmBitsDrop) + (t.cheapPlasma ? ", cheap plasma)" : ")"));
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+}
+
+// =======================================================
+// FRAME TIMING METRICS
+// =======================================================
+/**
+ * Per-stage frame timings of the render loop.
+ *
+ * The render thread is the only writer: every frame it pushes one FrameSample
+ * into a fixed ring of recent frames. Each ring slot is guarded by its own
+ * sequence counter (odd while being written), so API threads can take a
+ * consistent snapshot without ever blocking the render thread; a slot that
+ * is overwritten during the copy is simply skipped.
+ *
+ * In pipelined mode the copy and swap stages run on the copy thread, which
+ * publishes its last durations through atomics that the render thread folds
+ * into the sample of the frame that submitted them.
+ */
+enum FrameStage {
+    STAGE_INTERP, STAGE_UNIFORMS, STAGE_DRAW, STAGE_READBACK, STAGE_QUEUE,
+    STAGE_COPY, STAGE_SWAP, STAGE_SLEEP, STAGE_COUNT
+};
+static const char *const STAGE_NAMES[STAGE_COUNT] = {
+    "interp", "uniforms", "draw", "readback", "queue", "copy", "swap", "sleep"
+};
+
+struct FrameSample {
+    uint32_t us[STAGE_COUNT] = {};
+    uint32_t busy_us = 0;     // everything except sleep
+};
+
+class FrameStats {
+public:
+    static const int CAPACITY = 512;
+
+    // Render thread only.
+    void push(const FrameSample &smp, bool dropped) {
+        uint64_t h = head_.load(std::memory_order_relaxed);
+        Slot &sl = slots_[h % CAPACITY];
+        uint32_t seq = sl.seq.load(std::memory_order_relaxed);
+        sl.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (int i = 0; i < STAGE_COUNT; i++) sl.us[i].store(smp.us[i], std::memory_order_relaxed);
+        sl.busy_us.store(smp.busy_us, std::memory_order_relaxed);
+        sl.seq.store(seq + 2, std::memory_order_release);
+        head_.store(h + 1, std::memory_order_release);
+
+        for (int i = 0; i < STAGE_COUNT; i++) stage_us_total_[i].fetch_add(smp.us[i], std::memory_order_relaxed);
+        busy_us_total_.fetch_add(smp.busy_us, std::memory_order_relaxed);
+        frames_.fetch_add(1, std::memory_order_relaxed);
+        if (dropped) dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Any thread: copies up to CAPACITY of the most recent consistent samples.
+    std::vector<FrameSample> snapshot() const {
+        std::vector<FrameSample> out;
+        uint64_t h = head_.load(std::memory_order_acquire);
+        uint64_t n = std::min<uint64_t>(h, CAPACITY);
+        out.reserve(n);
+        for (uint64_t k = h - n; k < h; k++) {
+            const Slot &sl = slots_[k % CAPACITY];
+            uint32_t s1 = sl.seq.load(std::memory_order_acquire);
+            if (s1 & 1) continue;
+            FrameSample smp;
+            for (int i = 0; i < STAGE_COUNT; i++) smp.us[i] = sl.us[i].load(std::memory_order_relaxed);
+            smp.busy_us = sl.busy_us.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sl.seq.load(std::memory_order_relaxed) != s1) continue;
+            out.push_back(smp);
+        }
+        return out;
+    }
+
+    // Render thread: a frame skipped by static scene detection (no sample recorded).
+    void count_skipped() { skipped_.fetch_add(1, std::memory_order_relaxed); }
+
+    uint64_t frames() const { return frames_.load(std::memory_order_relaxed); }
+    uint64_t skipped() const { return skipped_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+    uint64_t stage_us_total(int st) const { return stage_us_total_[st].load(std::memory_order_relaxed); }
+    uint64_t busy_us_total() const { return busy_us_total_.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> seq{0};
+        std::atomic<uint32_t> us[STAGE_COUNT];
+        std::atomic<uint32_t> busy_us{0};
+    };
+    Slot slots_[CAPACITY];
+    std::atomic<uint64_t> head_{0};
+    std::atomic<uint64_t> frames_{0}, dropped_{0}, skipped_{0}, busy_us_total_{0};
+    std::atomic<uint64_t> stage_us_total_[STAGE_COUNT] = {};
+};
+
+static FrameStats g_frameStats;
+
+// Copy-thread stage durations of the most recent pipelined frame (microseconds)
+static std::atomic<uint32_t> g_pipeCopyUs{0}, g_pipeSwapUs{0};
+
+// Render-path description for /metrics (set once before the main loop)
+static std::string g_renderPath = "pbuffer_rgb";
+
+// Frame rate and background scale chosen by the governor (written by the render thread)
+static std::atomic<int> g_govFps{0}, g_govBgScale{1};
+
+// UDP update channel packet counters (written by the UDP thread)
+static std::atomic<uint64_t> g_udpAccepted{0}, g_udpStale{0}, g_udpRejected{0};
+
+// Preview stream viewers and encoded frames, status event subscribers (written by the stream thread)
+static std::atomic<int> g_previewClients{0}, g_eventClients{0};
+static std::atomic<uint64_t> g_previewFrames{0};
+
+// Fleet sync packets and the follower's clock error (written by the sync threads / render thread)
+static std::atomic<uint64_t> g_syncSent{0}, g_syncAccepted{0}, g_syncStale{0}, g_syncRejected{0}, g_syncSteps{0};
+static std::atomic<int32_t> g_syncOffsetUs{0};
+
+// Accepted updates: taken by the render loop, or merged into a still-staged target
+static std::atomic<uint64_t> g_updatesApplied{0}, g_updatesMerged{0};
+
+// GET /status answers with a body and 304s for an unchanged If-None-Match
+static std::atomic<uint64_t> g_statusFull{0}, g_statusNotModified{0};
+
+// Nearest-rank quantile of an unsorted sample set (reorders v).
+static uint32_t quantile_us(std::vector<uint32_t> &v, double q) {
+    if (v.empty()) return 0;
+    size_t k = (size_t)std::min<double>(v.size() - 1, q * v.size());
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+// Prometheus text exposition of the frame timing ring.
+static std::string metrics_to_prometheus() {
+    std::vector<FrameSample> win = g_frameStats.snapshot();
+    static const double QS[] = { 0.5, 0.95, 0.99 };
+    std::ostringstream m;
+    m << std::setprecision(6);
+    auto emit_summary = [&](const char *labels, std::vector<uint32_t> &vals, uint64_t sum_us) {
+        for (double q : QS)
+            m << "ledcube_frame_stage_seconds{" << labels << ",quantile=\"" << q << "\"} " << quantile_us(vals, q) / 1e6 << "\n";
+        m << "ledcube_frame_stage_seconds_sum{" << labels << "} " << sum_us / 1e6 << "\n";
+        m << "ledcube_frame_stage_seconds_count{" << labels << "} " << g_frameStats.frames() << "\n";
+    };
+
+    m << "# HELP ledcube_frame_stage_seconds Render loop time per stage (quantiles over the last " << win.size() << " frames).\n";
+    m << "# TYPE ledcube_frame_stage_seconds summary\n";
+    std::vector<uint32_t> vals(win.size());
+    for (int st = 0; st < STAGE_COUNT; st++) {
+        for (size_t i = 0; i < win.size(); i++) vals[i] = win[i].us[st];
+        std::string labels = std::string("stage=\"") + STAGE_NAMES[st] + "\"";
+        emit_summary(labels.c_str(), vals, g_frameStats.stage_us_total(st));
+    }
+    for (size_t i = 0; i < win.size(); i++) vals[i] = win[i].busy_us;
+    emit_summary("stage=\"busy\"", vals, g_frameStats.busy_us_total());
+
+    m << "# HELP ledcube_frames_total Frames produced by the render loop.\n";
+    m << "# TYPE ledcube_frames_total counter\n";
+    m << "ledcube_frames_total " << g_frameStats.frames() << "\n";
+    m << "# HELP ledcube_frames_dropped_total Frames that finished after their pacing deadline.\n";
+    m << "# TYPE ledcube_frames_dropped_total counter\n";
+    m << "ledcube_frames_dropped_total " << g_frameStats.dropped() << "\n";
+    m << "# HELP ledcube_frames_skipped_total Idle ticks where rendering was skipped because the scene was static.\n";
+    m << "# TYPE ledcube_frames_skipped_total counter\n";
+    m << "ledcube_frames_skipped_total " << g_frameStats.skipped() << "\n";
+    m << "# HELP ledcube_target_fps Configured frame rate target.\n";
+    m << "# TYPE ledcube_target_fps gauge\n";
+    int targetFps;
+    {
+        std::lock_guard<std::mutex> lk(config_mtx);
+        targetFps = g_liveConfig.targetFps;
+    }
+    m << "ledcube_target_fps " << targetFps << "\n";
+    m << "# HELP ledcube_governor_fps Frame rate currently scheduled by the governor.\n";
+    m << "# TYPE ledcube_governor_fps gauge\n";
+    m << "ledcube_governor_fps " << g_govFps.load() << "\n";
+    if (g_thermalActive) {
+        m << "# HELP ledcube_thermal_tier Current thermal tier (0 normal, 1 warm, 2 hot, 3 critical).\n";
+        m << "# TYPE ledcube_thermal_tier gauge\n";
+        m << "ledcube_thermal_tier{tier=\"" << THERMAL_TIERS[g_thermalTier.load()].name << "\"} " << g_thermalTier.load() << "\n";
+        m << "# HELP ledcube_thermal_tier_changes_total Thermal tier changes since start.\n";
+        m << "# TYPE ledcube_thermal_tier_changes_total counter\n";
+        m << "ledcube_thermal_tier_changes_total " << g_thermalChanges.load() << "\n";
+        m << "# HELP ledcube_soc_temperature_celsius SoC temperature at the last thermal poll.\n";
+        m << "# TYPE ledcube_soc_temperature_celsius gauge\n";
+        m << "ledcube_soc_temperature_celsius " << g_socTempMilli.load() / 1000.0 << "\n";
+        m << "# HELP ledcube_soc_throttled Firmware get_throttled flags (bit 0 under-voltage, 1 freq capped, 2 throttled, 3 soft temp limit; bits 16-19: the same since boot).\n";
+        m << "# TYPE ledcube_soc_throttled gauge\n";
+        m << "ledcube_soc_throttled " << g_socThrottled.load() << "\n";
+    }
+    m << "# HELP ledcube_bg_scale Current background downscale factor (1: inline full resolution).\n";
+    m << "# TYPE ledcube_bg_scale gauge\n";
+    m << "ledcube_bg_scale " << g_govBgScale.load() << "\n";
+    if (g_startPhase >= PHASE_RENDERING) {   // g_renderPath is written once, before the phase changes
+        m << "# HELP ledcube_render_info Active render path.\n";
+        m << "# TYPE ledcube_render_info gauge\n";
+        m << "ledcube_render_info{path=\"" << g_renderPath << "\"} 1\n";
+    }
+    m << "# HELP ledcube_startup_seconds Time from start until the API listened and rendering began, and the length of the parallel renderer and matrix init.\n";
+    m << "# TYPE ledcube_startup_seconds gauge\n";
+    const std::pair<const char *, int> startup[] = {{"api", g_apiUpMs}, {"renderer", g_rendererMs}, {"matrix", g_matrixMs}, {"ready", g_readyMs}};
+    for (const auto &p : startup)
+        if (p.second >= 0) m << "ledcube_startup_seconds{phase=\"" << p.first << "\"} " << p.second / 1000.0 << "\n";
+    m << "# HELP ledcube_updates_total Accepted updates taken by the render loop, or merged into one still waiting for it.\n";
+    m << "# TYPE ledcube_updates_total counter\n";
+    m << "ledcube_updates_total{result=\"applied\"} " << g_updatesApplied.load() << "\n";
+    m << "ledcube_updates_total{result=\"merged\"} " << g_updatesMerged.load() << "\n";
+    m << "# HELP ledcube_status_requests_total GET /status requests, by whether a body was sent or 304 Not Modified.\n";
+    m << "# TYPE ledcube_status_requests_total counter\n";
+    m << "ledcube_status_requests_total{result=\"full\"} " << g_statusFull.load() << "\n";
+    m << "ledcube_status_requests_total{result=\"not_modified\"} " << g_statusNotModified.load() << "\n";
+    if (g_cfg.streamPort != 0) {
+        m << "# HELP ledcube_preview_clients Connected preview stream viewers.\n";
+        m << "# TYPE ledcube_preview_clients gauge\n";
+        m << "ledcube_preview_clients " << g_previewClients.load() << "\n";
+        m << "# HELP ledcube_preview_frames_total Preview frames encoded (once per tick, shared by all viewers).\n";
+        m << "# TYPE ledcube_preview_frames_total counter\n";
+        m << "ledcube_preview_frames_total " << g_previewFrames.load() << "\n";
+        m << "# HELP ledcube_event_clients Connected /events subscribers.\n";
+        m << "# TYPE ledcube_event_clients gauge\n";
+        m << "ledcube_event_clients " << g_eventClients.load() << "\n";
+    }
+    if (g_capture.active()) {
+        m << "# HELP ledcube_capture_frames_total Frames handled by the capture writer, and frames dropped because its queue was full.\n";
+        m << "# TYPE ledcube_capture_frames_total counter\n";
+        m << "ledcube_capture_frames_total{result=\"written\"} " << g_capture.written() << "\n";
+        m << "ledcube_capture_frames_total{result=\"dropped\"} " << g_capture.dropped() << "\n";
+    }
+    if (g_shaderReady) {
+        m << "# HELP ledcube_shader_reloads_total User shader builds (POST /shader, shader file changes) by outcome.\n";
+        m << "# TYPE ledcube_shader_reloads_total counter\n";
+        m << "ledcube_shader_reloads_total{result=\"ok\"} " << g_shaderReloadsOk.load() << "\n";
+        m << "ledcube_shader_reloads_total{result=\"failed\"} " << g_shaderReloadsFailed.load() << "\n";
+    }
+    if (g_programCache.enabled()) {
+        m << "# HELP ledcube_program_cache_total Programs loaded from shader-cache, or compiled because no usable binary was cached.\n";
+        m << "# TYPE ledcube_program_cache_total counter\n";
+        m << "ledcube_program_cache_total{result=\"hit\"} " << g_programCache.hits() << "\n";
+        m << "ledcube_program_cache_total{result=\"miss\"} " << g_programCache.misses() << "\n";
+    }
+    m << "# HELP ledcube_log_lines_total Log lines written, suppressed by the per-category rate limit, or dropped because the ring was full.\n";
+    m << "# TYPE ledcube_log_lines_total counter\n";
+    m << "ledcube_log_lines_total{result=\"written\"} " << g_log.written() << "\n";
+    m << "ledcube_log_lines_total{result=\"suppressed\"} " << g_log.suppressed() << "\n";
+    m << "ledcube_log_lines_total{result=\"dropped\"} " << g_log.dropped() << "\n";
+    if (g_cfg.sync != "off") {
+        m << "# HELP ledcube_sync_packets_total Fleet sync packets sent (leader) or received by outcome (follower).\n";
+        m << "# TYPE ledcube_sync_packets_total counter\n";
+        if (g_cfg.sync == "leader") {
+            m << "ledcube_sync_packets_total{result=\"sent\"} " << g_syncSent.load() << "\n";
+        } else {
+            m << "ledcube_sync_packets_total{result=\"accepted\"} " << g_syncAccepted.load() << "\n";
+            m << "ledcube_sync_packets_total{result=\"stale\"} " << g_syncStale.load() << "\n";
+            m << "ledcube_sync_packets_total{result=\"rejected\"} " << g_syncRejected.load() << "\n";
+            m << "# HELP ledcube_sync_offset_seconds Leader clock minus local clock before the last correction.\n";
+            m << "# TYPE ledcube_sync_offset_seconds gauge\n";
+            m << "ledcube_sync_offset_seconds " << g_syncOffsetUs.load() / 1e6 << "\n";
+            m << "# HELP ledcube_sync_steps_total Clock steps to the leader (start-up, leader restart) instead of slewing.\n";
+            m << "# TYPE ledcube_sync_steps_total counter\n";
+            m << "ledcube_sync_steps_total " << g_syncSteps.load() << "\n";
+        }
+    }
+    if (g_cfg.udpPort != 0) {
+        m << "# HELP ledcube_udp_packets_total UDP update packets by outcome.\n";
+        m << "# TYPE ledcube_udp_packets_total counter\n";
+        m << "ledcube_udp_packets_total{result=\"accepted\"} " << g_udpAccepted.load() << "\n";
+        m << "ledcube_udp_packets_total{result=\"stale\"} " << g_udpStale.load() << "\n";
+        m << "ledcube_udp_packets_total{result=\"rejected\"} " << g_udpRejected.load() << "\n";
+    }
+    return m.str();
+}
+
+// =======================================================
+// FRAME PACING
+// =======================================================
+/**
+ * Adaptive frame-rate governor.
+ *
+ * Frames are scheduled against absolute CLOCK_MONOTONIC deadlines
+ * (clock_nanosleep with TIMER_ABSTIME), so oversleeping in one frame
+ * shortens the next sleep instead of accumulating as drift. A frame that
+ * ends more than one period past its deadline re-anchors the schedule
+ * rather than bursting to catch up.
+ *
+ * Each rendered frame reports its *work*: busy time minus the time spent
+ * blocked on the display (SwapOnVSync in serial mode, waiting for a free
+ * pipeline slot in pipelined mode). Waiting is the display pacing us, not a
+ * sign that frames are too expensive. Once a window of GOV_WINDOW frames
+ * is full, the governor:
+ * - steps down a level when p90 work exceeds GOV_HIGH of the current period;
+ * - steps back up when p90 work would fit in GOV_LOW of the faster level's
+ *   period, after the level has held for the hold time. Falling straight
+ *   back down doubles the hold time (up to GOV_HOLD_MAX_SEC).
+ *
+ * Levels are the rate ladder (the target rate times GOV_LADDER), optionally
+ * followed by background steps that halve the background resolution again
+ * at the lowest rate.
+ */
+static const int    GOV_WINDOW = 30;
+static const double GOV_HIGH = 0.90, GOV_LOW = 0.60;
+static const double GOV_HOLD_SEC = 3.0, GOV_HOLD_MAX_SEC = 60.0;
+static const double GOV_LADDER[] = { 1.0, 0.75, 0.5, 1.0 / 3.0 };
+static const int    GOV_RATES = sizeof(GOV_LADDER) / sizeof(GOV_LADDER[0]);
+
+class FrameGovernor {
+public:
+    FrameGovernor(bool adaptive, int bgSteps) : adaptive_(adaptive), bgSteps_(bgSteps) {}
+
+    // Rebuilds the ladder for a new configured rate and restarts at its top
+    void set_target(int fps) {
+        if (fps == target_) return;
+        target_ = fps;
+        level_ = 0;
+        hold_ = GOV_HOLD_SEC;
+        work_.clear();
+    }
+
+    int fps() const { return rate(level_); }
+    int bg_step() const { return level_ < GOV_RATES ? 0 : level_ - (GOV_RATES - 1); }
+
+    /**
+     * Feeds one rendered frame. Returns the level change (+1: slower,
+     * -1: faster, 0: unchanged).
+     */
+    int observe(uint32_t work_us, double now) {
+        if (!adaptive_) return 0;
+        work_.push_back(work_us);
+        if ((int)work_.size() < GOV_WINDOW) return 0;
+        const double p90 = quantile_us(work_, 0.9);
+        work_.clear();
+
+        const int maxLevel = GOV_RATES - 1 + bgSteps_;
+        if (p90 > GOV_HIGH * period_us(level_) && level_ < maxLevel) {
+            // Falling back right after a step up: that level was too optimistic
+            if (now - changed_ < 2 * hold_ && lastStep_ < 0) hold_ = std::min(hold_ * 2, GOV_HOLD_MAX_SEC);
+            return step(+1, now);
+        }
+        if (level_ > 0 && now - changed_ >= hold_ && p90 < GOV_LOW * period_us(level_ - 1)) {
+            if (now - changed_ > 4 * hold_) hold_ = GOV_HOLD_SEC;   // long stable stretch: forget the backoff
+            return step(-1, now);
+        }
+        return 0;
+    }
+
+    /**
+     * Sleeps until the next deadline at fps frames per second. Returns false
+     * when the frame ended after its deadline (a dropped frame).
+     */
+    bool wait(int fps) {
+        const int64_t period = 1000000000LL / fps;
+        const int64_t now = mono_ns();
+        if (next_ == 0) next_ = now;
+        next_ += period;
+        const bool onTime = now <= next_;
+        if (now - next_ > period) next_ = now;      // too far behind: re-anchor instead of bursting
+        timespec ts = { (time_t)(next_ / 1000000000LL), (long)(next_ % 1000000000LL) };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+        return onTime;
+    }
+
+private:
+    int rate(int level) const {
+        int r = (int)lround(target_ * GOV_LADDER[std::min(level, GOV_RATES - 1)]);
+        return r < 1 ? 1 : r;
+    }
+    double period_us(int level) const { return 1e6 / rate(level); }
+
+    int step(int dir, double now) {
+        level_ += dir;
+        lastStep_ = dir;
+        changed_ = now;
+        return dir;
+    }
+
+    static int64_t mono_ns() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+    bool adaptive_;
+    int bgSteps_;
+    int target_ = 0, level_ = 0, lastStep_ = 0;
+    double changed_ = -1e9, hold_ = GOV_HOLD_SEC;
+    int64_t next_ = 0;
+    std::vector<uint32_t> work_;
+};
+
+// =======================================================
+// RUNTIME CONFIGURATION
+// =======================================================
+/**
+ * Every setting has one key, used as "key = value" in the config file and
+ * as "--key=value" on the command line. Later sources win: defaults, then
+ * --config=PATH, then the other flags in order. led-* keys in the file are
+ * handed to CreateMatrixFromFlags() as --led-* flags ahead of the real
+ * command line, so a --led-* flag still overrides the file.
+ */
+static const int   MAX_FPS = 240;
+static const float MAX_ANIM_STEP = 10000.0f;
+static const float MAX_GRAY_TIME = 86400.0f;
+
+static bool int_value(const std::string &key, const std::string &v, int lo, int hi, int &out) {
+    char *end = nullptr;
+    long n = strtol(v.c_str(), &end, 10);
+    if (v.empty() || *end != '\0' || n < lo || n > hi) {
+        log_ts("INIT: " + key + " must be an integer between " + std::to_string(lo) + " and " + std::to_string(hi));
+        return false;
+    }
+    out = (int)n;
+    return true;
+}
+
+static bool float_value(const std::string &key, const std::string &v, float lo, float hi, float &out) {
+    char *end = nullptr;
+    float f = strtof(v.c_str(), &end);
+    if (v.empty() || *end != '\0' || !(f >= lo && f <= hi)) {
+        log_ts("INIT: " + key + " must be a number between " + fmt_float(lo) + " and " + fmt_float(hi));
+        return false;
+    }
+    out = f;
+    return true;
+}
+
+// Applies one setting; unknown keys are logged and ignored
+static bool set_option(const std::string &key, const std::string &v, Config &cfg, LiveConfig &lc) {
+    if (key == "api-token") {
+        if (v.empty()) { log_ts("INIT: api-token must not be empty"); return false; }
+        cfg.apiToken = v;
+        return true;
+    }
+    if (key == "api-port")       return int_value(key, v, 1, 65535, cfg.apiPort);
+    if (key == "udp-port")       return int_value(key, v, 0, 65535, cfg.udpPort);
+    if (key == "blank-interval") return int_value(key, v, 0, 86400, cfg.blankInterval);
+    if (key == "panel-size")     return int_value(key, v, 8, 256, cfg.panelSize);
+    if (key == "segments")       return int_value(key, v, 1, MAX_SEGMENTS, cfg.segments);
+    if (key == "bg-scale")       return int_value(key, v, 1, 16, cfg.bgScale);
+    if (key == "bg-interval")    return int_value(key, v, 1, 60, cfg.bgInterval);
+    if (key == "governor")       return int_value(key, v, 0, 1, cfg.governor);
+    if (key == "max-bg-scale")   return int_value(key, v, 0, 16, cfg.maxBgScale);
+    if (key == "render-threads") return int_value(key, v, 0, 16, cfg.renderThreads);
+    if (key == "refresh-core")   return int_value(key, v, -1, 63, cfg.refreshCore);
+    if (key == "stream-port")    return int_value(key, v, 0, 65535, cfg.streamPort);
+    if (key == "preview-fps")    return int_value(key, v, 1, 30, cfg.previewFps);
+    if (key == "preview-scale")  return int_value(key, v, 1, 16, cfg.previewScale);
+    if (key == "preview-quality") return int_value(key, v, 1, 100, cfg.previewQuality);
+    if (key == "capture")        { cfg.capture = v; return true; }
+    if (key == "shader")         { cfg.shader = v; return true; }
+    if (key == "shader-cache")   { cfg.shaderCache = v; return true; }
+    if (key == "capture-frames") return int_value(key, v, 0, 100000000, cfg.captureFrames);
+    if (key == "sync-port")      return int_value(key, v, 1, 65535, cfg.syncPort);
+    if (key == "log-rate")       return int_value(key, v, 0, 100000, cfg.logRate);
+    if (key == "gamma")          return float_value(key, v, 0.1f, 5.0f, cfg.gamma);
+    if (key == "thermal")        return int_value(key, v, 0, 1, cfg.thermal);
+    if (key == "thermal-limit")  return float_value(key, v, 50.0f, 95.0f, cfg.thermalLimit);
+    if (key == "white-balance") {
+        if (!parse_hex_color(v.c_str(), cfg.whiteBalance)) { log_ts("INIT: white-balance must be #RRGGBB"); return false; }
+        return true;
+    }
+    if (key == "heat-palette") {
+        std::vector<PaletteStop> stops;
+        if (!parse_heat_palette(v, stops)) {
+            log_ts("INIT: heat-palette must be 2.." + std::to_string(MAX_PALETTE_STOPS) + " pos:#RRGGBB stops, pos 0..100 non-decreasing");
+            return false;
+        }
+        cfg.heatPalette = v;
+        return true;
+    }
+    if (key == "log-format") {
+        if (v != "text" && v != "json") { log_ts("INIT: log-format must be text or json"); return false; }
+        cfg.logFormat = v;
+        return true;
+    }
+    if (key == "sync-group") {
+        in_addr a;
+        if (inet_aton(v.c_str(), &a) == 0 || !IN_MULTICAST(ntohl(a.s_addr))) { log_ts("INIT: sync-group must be an IPv4 multicast address"); return false; }
+        cfg.syncGroup = v;
+        return true;
+    }
+    if (key == "sync") {
+        if (v != "off" && v != "leader" && v != "follower") { log_ts("INIT: sync must be off, leader or follower"); return false; }
+        cfg.sync = v;
+        return true;
+    }
+#ifdef LEDCUBE_BENCHMARK
+    if (key == "bench-frames")   return int_value(key, v, 1, 100000, cfg.benchFrames);
+    if (key == "bench-replay")   { cfg.benchReplay = v; return true; }
+    if (key == "bench-golden")   { cfg.benchGolden = v; return true; }
+#endif
+    if (key == "renderer") {
+        if (v != "auto" && v != "gpu" && v != "cpu") { log_ts("INIT: renderer must be auto, gpu or cpu"); return false; }
+        cfg.renderer = v;
+        return true;
+    }
+    if (key == "fps")            return int_value(key, v, 1, MAX_FPS, lc.targetFps);
+    if (key == "anim-step")      return float_value(key, v, 0.0f, MAX_ANIM_STEP, lc.animStep);
+    if (key == "gray-start")     return float_value(key, v, 0.0f, MAX_GRAY_TIME, lc.grayStart);
+    if (key == "gray-end")       return float_value(key, v, 0.0f, MAX_GRAY_TIME, lc.grayEnd);
+    log_ts("INIT: Ignoring unknown option " + key);
+    return true;
+}
+
+static std::string trim(const std::string &s) {
+    size_t b = s.find_first_not_of(" \t\r"), e = s.find_last_not_of(" \t\r");
+    return b == std::string::npos ? std::string() : s.substr(b, e - b + 1);
+}
+
+// "key = value" lines; blank lines and lines starting with # are ignored
+static bool load_config_file(const std::string &path, Config &cfg, LiveConfig &lc) {
+    std::ifstream in(path);
+    if (!in) { log_ts("INIT: Cannot open config file " + path); return false; }
+    std::string line;
+    for (int lineNo = 1; std::getline(in, line); lineNo++) {
+        line = trim(line);
+        if (line.empty() || line[0] == '#') continue;
+        size_t eq = line.find('=');
+        std::string key = trim(line.substr(0, eq));
+        if (!key.compare(0, 4, "led-")) {
+            // Matrix flag, e.g. "led-brightness = 60" or "led-no-hardware-pulse"
+            cfg.matrixFlags.push_back("--" + key + (eq == std::string::npos ? "" : "=" + trim(line.substr(eq + 1))));
+            continue;
+        }
+        if (eq == std::string::npos || key.empty()) {
+            log_ts("INIT: " + path + ":" + std::to_string(lineNo) + ": expected key = value");
+            return false;
+        }
+        if (!set_option(key, trim(line.substr(eq + 1)), cfg, lc)) {
+            log_ts("INIT: ... in " + path + ":" + std::to_string(lineNo));
+            return false;
+        }
+    }
+    return true;
+}
+
+// Cross-field rules of the live settings; shared with POST /config
+static const char *check_live_config(const LiveConfig &lc) {
+    if (lc.grayEnd <= lc.grayStart) return "gray-end must be greater than gray-start";
+    return nullptr;
+}
+
+/**
+ * Loads the configuration into cfg/lc and collects the arguments meant for
+ * CreateMatrixFromFlags() in matrixArgs (argv[0], the file's led-* keys, then
+ * the command line minus our own flags).
+ */
+static bool load_config(int argc, char *argv[], Config &cfg, LiveConfig &lc, std::vector<std::string> &matrixArgs) {
+    for (int i = 1; i < argc; i++)
+        if (!strncmp(argv[i], "--config=", 9) && !load_config_file(argv[i] + 9, cfg, lc)) return false;
+
+    matrixArgs.assign(1, argv[0]);
+    matrixArgs.insert(matrixArgs.end(), cfg.matrixFlags.begin(), cfg.matrixFlags.end());
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        if (!strncmp(a, "--led-", 6)) { matrixArgs.push_back(a); continue; }
+        if (!strncmp(a, "--config=", 9)) continue;
+        const char *eq = strchr(a, '=');
+        if (strncmp(a, "--", 2) != 0 || !eq) {
+            log_ts(std::string("INIT: Ignoring unknown option ") + a);
+            continue;
+        }
+        if (!set_option(std::string(a + 2, eq), eq + 1, cfg, lc)) return false;
+    }
+
+    if (cfg.panelSize % 4 != 0) {
+        // The CPU renderer walks its per-pixel tables 4 pixels at a time, without a tail
+        log_ts("INIT: panel-size must be a multiple of 4");
+        return false;
+    }
+    if (cfg.panelSize % cfg.bgScale != 0) {
+        log_ts("INIT: bg-scale must divide the panel size (" + std::to_string(cfg.panelSize) + ")");
+        return false;
+    }
+    if (cfg.panelSize % cfg.previewScale != 0) {
+        log_ts("INIT: preview-scale must divide the panel size (" + std::to_string(cfg.panelSize) + ")");
+        return false;
+    }
+    if (cfg.maxBgScale != 0 && (cfg.bgScale < 2 || cfg.maxBgScale < cfg.bgScale)) {
+        log_ts("INIT: max-bg-scale needs bg-scale >= 2 and must not be below it");
+        return false;
+    }
+    if (const char *err = check_live_config(lc)) { log_ts(std::string("INIT: ") + err); return false; }
+    return true;
+}
+
+/**
+ * POST /config body: any of "targetFps", "animStep", "grayStart" and
+ * "grayEnd" (the GET /config names). Fields are applied to lc in place;
+ * err is set for a malformed body or an out-of-range value.
+ */
+static bool parse_live_config_json(const char *body, size_t len, LiveConfig &lc, const char *&err) {
+    JsonCursor c(body, len);
+    err = "Invalid JSON";
+    if (!c.eat('{')) return false;
+    if (c.eat('}')) return c.done();
+
+    char key[24];
+    bool trunc;
+    do {
+        if (!c.string(key, sizeof(key), trunc) || !c.eat(':')) return false;
+        if (trunc) key[0] = '\0';
+
+        float v;
+        float *dst = !strcmp(key, "animStep") ? &lc.animStep
+                   : !strcmp(key, "grayStart") ? &lc.grayStart
+                   : !strcmp(key, "grayEnd") ? &lc.grayEnd : nullptr;
+        if (!strcmp(key, "targetFps")) {
+            if (!c.number(v)) return false;
+            if (!(v >= 1 && v <= MAX_FPS)) { err = "targetFps out of range"; return false; }
+            if (v != floorf(v)) { err = "targetFps must be an integer"; return false; }
+            lc.targetFps = (int)v;
+        } else if (dst) {
+            if (!c.number(v)) return false;
+            float hi = dst == &lc.animStep ? MAX_ANIM_STEP : MAX_GRAY_TIME;
+            if (!(v >= 0 && v <= hi)) { err = "Value out of range"; return false; }
+            *dst = v;
+        } else if (!c.skip()) {
+            return false;
+        }
+    } while (c.eat(','));
+    if (!c.eat('}') || !c.done()) return false;
+
+    err = check_live_config(lc);
+    return err == nullptr;
+}
+
+// =======================================================
+// STATUS SNAPSHOT (GET /status, /events)
+// =======================================================
+/**
+ * The /status body is serialized at most STATUS_HZ times per second, however
+ * many clients poll it: readers share the newest snapshot, and only a reader
+ * that finds it older than one tick formats a new one. A body that comes out
+ * unchanged keeps its ETag and seq, so conditional GETs are answered 304 and
+ * the event stream sends nothing. `age` is reported in 0.1 s steps for the
+ * same reason.
+ */
+struct StatusSnapshot {
+    std::string state;      // the body without the values that change on their own (age, socTemp)
+    std::string json;
+    std::string etag;       // weak ETag, FNV-1a of state
+    uint64_t seq = 0;       // bumped whenever state changes
+};
+
+static const int STATUS_HZ = 10;
+
+static std::shared_ptr<const StatusSnapshot> g_status;     // guarded by live_read_mtx
+static std::chrono::steady_clock::time_point g_statusBuilt;
+
+/**
+ * The /status body up to its last field, without `age` and `socTemp`. Those
+ * change by themselves every tick, so they are appended by status_tail()
+ * and kept out of the ETag; an unchanged state then really yields 304 and
+ * no /events push.
+ */
+static std::string status_state_json(const LiveStatus &live) {
+    const VisualState &st = live.state;
+    float age = live.age;
+    std::ostringstream json;
+    json << "{"
+         << "\"colour\":" << st.colourLevel
+         << ",\"geometry\":\"" << st.geom_name() << "\""
+         << ",\"segments\":" << segments_to_string(st.segment)
+         << ",\"quiet\":" << ((g_cfg.blankInterval != 0 && age > g_cfg.blankInterval) ? "true" : "false")
+         << ",\"mode\":\"" << json_escape(st.mode) << "\""
+         << ",\"width\":" << st.elementWidth
+         << ",\"percent\":" << st.percent
+         << ",\"timeline\":" << (live.timeline ? "true" : "false");
+    if (g_thermalActive) json << ",\"thermal\":\"" << THERMAL_TIERS[g_thermalTier.load()].name << "\"";
+    json << ",\"elements\":[";
+    for (int i = 0; i < st.nlayers; i++) {
+        const Layer &l = st.layer[i];
+        json << (i ? "," : "") << "{\"geometry\":\"" << GEOM_NAMES[l.geometryMode] << "\""
+             << ",\"radius\":" << l.radius << ",\"width\":" << l.width << ",\"percent\":" << l.percent << "}";
+    }
+    json << "]";
+    return json.str();
+}
+
+static std::string status_tail(const LiveStatus &live) {
+    std::string tail = ",\"age\":" + fmt_float(live.age, 1);
+    if (g_thermalActive) tail += ",\"socTemp\":" + fmt_float(g_socTempMilli.load() / 1000.0f, 1);
+    return tail + "}";
+}
+
+// The current snapshot, rebuilt from the render loop's LiveStatus once per tick
+static std::shared_ptr<const StatusSnapshot> status_snapshot() {
+    std::lock_guard<std::mutex> lk(live_read_mtx);
+    auto now = std::chrono::steady_clock::now();
+    if (g_status && now - g_statusBuilt < std::chrono::milliseconds(1000 / STATUS_HZ)) return g_status;
+    g_statusBuilt = now;
+
+    const LiveStatus live = g_liveBuf.read();
+    std::string state = status_state_json(live);
+    std::string json = state + status_tail(live);
+    if (g_status && g_status->json == json) return g_status;
+    std::shared_ptr<StatusSnapshot> snap = std::make_shared<StatusSnapshot>();
+    if (g_status && g_status->state == state) {
+        // Only age or socTemp moved: fresh body, same validator and event seq
+        snap->etag = g_status->etag;
+        snap->seq = g_status->seq;
+    } else {
+        char etag[20];
+        snprintf(etag, sizeof(etag), "W/\"%08x\"", fnv1a32(state.data(), state.size()));
+        snap->etag = etag;
+        snap->seq = g_status ? g_status->seq + 1 : 1;
+    }
+    snap->state = std::move(state);
+    snap->json = std::move(json);
+    g_status = snap;
+    return g_status;
+}
+
+// =======================================================
+// REST API
+// =======================================================
+// Caller holds target_mtx and has changed g_target: hand it to the next frame
+static void stage_target_locked() {
+    g_target.generation++;
+    if (g_targetStaged.exchange(true, std::memory_order_release)) g_updatesMerged++;
+}
+
+/**
+ * Render thread: copies the staged target into `out`, at most once per frame.
+ * Never waits; while an API thread holds target_mtx the copy waits a frame.
+ */
+static bool take_staged_target(VisualState &out) {
+    if (!g_targetStaged.load(std::memory_order_acquire)) return false;
+    std::unique_lock<std::mutex> lk(target_mtx, std::try_to_lock);
+    if (!lk.owns_lock()) return false;
+    out = g_target;
+    g_targetStaged.store(false, std::memory_order_relaxed);
+    g_updatesApplied++;
+    return true;
+}
+
+// Stops a playing timeline; caller holds target_mtx
+static void stop_timeline_locked() {
+    if (!g_timelinePublished) return;
+    Timeline &tl = g_timelineBuf.back();
+    tl.count = 0;
+    tl.generation = ++g_timelineGeneration;
+    g_timelineBuf.publish();
+    g_timelinePublished = false;
+}
+
+/**
+ * Applies one update to the API-owned target and stages it for the render
+ * loop. Updates that arrive before the next frame are coalesced: the frame
+ * takes only the latest target, counted as merged, and restarts the
+ * signal-loss clock on its generation. Shared by the REST and UDP channels;
+ * logMsg (optional) receives the summary line so the caller can log it
+ * outside the lock.
+ */
+static bool commit_update(const UpdateFields &f, std::string *logMsg) {
+    std::lock_guard<std::mutex> lk(target_mtx);
+    VisualState &ts = g_target;
+    if (!apply_update(f, ts)) return false;
+
+    // A direct update takes over from any timeline that is still playing
+    stop_timeline_locked();
+
+    stage_target_locked();
+    sync_notify();
+
+    if (logMsg)
+        *logMsg = std::string("API: Updated Targets (Mode=") + ts.mode + ", Color=" + fmt_float(ts.colourLevel) + ", Geom=" + ts.geom_name() + ")";
+    return true;
+}
+
+/**
+ * Publishes a parsed timeline (count 0 stops playback). The target becomes
+ * the final keyframe, so once a non-looping timeline ends the scene stays
+ * there and later updates build on it.
+ */
+static void commit_timeline(const Timeline &parsed) {
+    std::lock_guard<std::mutex> lk(target_mtx);
+    Timeline &tl = g_timelineBuf.back();
+    for (int i = 0; i < parsed.count; i++) tl.key[i] = parsed.key[i];
+    tl.count = parsed.count;
+    tl.loop = parsed.loop;
+    tl.generation = ++g_timelineGeneration;
+    g_timelineBuf.publish();
+    g_timelinePublished = parsed.count > 0;
+
+    VisualState &ts = g_target;
+    uint32_t generation = ts.generation;
+    if (parsed.count > 0) ts = parsed.key[parsed.count - 1].state;
+    ts.generation = generation;
+    stage_target_locked();
+    sync_notify();
+}
+
+void startRestApi() {
+    httplib::Server svr; g_server = &svr;
+    svr.new_task_queue = [] { return new httplib::ThreadPool(3); };
+
+    auto set_cors = [](httplib::Response &res) {
+        res.set_header("Access-Control-Allow-Origin", "*");
+        res.set_header("Access-Control-Allow-Methods", "POST, GET, DELETE, OPTIONS");
+        res.set_header("Access-Control-Allow-Headers", "X-API-Token, Content-Type");
+    };
+
+    svr.Options(R"(.*)", [&](const httplib::Request&, httplib::Response& res) { set_cors(res); res.status = 204; });
+
+    svr.Post("/update", [&](const httplib::Request& req, httplib::Response& res) {
+        set_cors(res);
+        if (req.get_header_value("X-API-Token") != g_cfg.apiToken) { res.status = 401; return; }
+
+        UpdateFields f;
+        if (!parse_update_json(req.body.data(), req.body.size(), f)) {
+            res.status = 400; res.set_content("Invalid JSON", "text/plain"); return;
+        }
+
+        std::string msg;
+        if (!commit_update(f, &msg)) { res.status = 400; res.set_content("No valid fields", "text/plain"); return; }
+        log_ts(msg);
+
+        res.status = 200;
+        res.set_content("OK", "text/plain");
+    });
+
+    svr.Post("/timeline", [&](const httplib::Request& req, httplib::Response& res) {
+        set_cors(res);
+        if (req.get_header_value("X-API-Token") != g_cfg.apiToken) { res.status = 401; return; }
+
+        VisualState base;
+        {
+            std::lock_guard<std::mutex> lk(target_mtx);
+            base = g_target;
+        }
+        std::unique_ptr<Timeline> tl(new Timeline);   // ~15 KB, too big for a pool thread's stack frame
+        const char *err = nullptr;
+        if (!parse_timeline_json(req.body.data(), req.body.size(), base, *tl, err)) {
+            res.status = 400; res.set_content(err, "text/plain"); return;
+        }
+        commit_timeline(*tl);
+
+        std::ostringstream json;
+        json << "{\"ok\":true,\"keyframes\":" << tl->count << ",\"duration\":" << tl->duration()
+             << ",\"loop\":" << (tl->loop ? "true" : "false") << "}";
+        log_ts("API: Timeline " + (tl->count ? std::to_string(tl->count) + " keyframes, " + fmt_float(tl->duration()) + " s" + (tl->loop ? ", looping" : "") : std::string("stopped")));
+        res.set_content(json.str(), "application/json");
+    });
+
+    // User fragment shader (see USER SHADERS): POST compiles and swaps it in, DELETE restores the built-ins
+    auto shader_request = [&](const httplib::Request& req, httplib::Response& res) {
+        set_cors(res);
+        if (req.get_header_value("X-API-Token") != g_cfg.apiToken) { res.status = 401; return; }
+        if (g_startPhase < PHASE_RENDERING) { res.status = 503; res.set_header("Retry-After", "1"); res.set_content("Starting up", "text/plain"); return; }
+        if (!g_shaderReady) { res.status = 409; res.set_content("User shaders need the GPU renderer", "text/plain"); return; }
+        const bool restore = req.method == "DELETE";
+        if (!restore && (req.body.empty() || req.body.size() > MAX_SHADER_BYTES)) {
+            res.status = 400; res.set_content("Body must be 1.." + std::to_string(MAX_SHADER_BYTES) + " bytes of GLSL", "text/plain"); return;
+        }
+        std::string err;
+        if (!submit_user_shader(restore ? std::string() : req.body, err)) {
+            res.status = 400; res.set_content(err, "text/plain"); return;
+        }
+        res.set_content("OK", "text/plain");
+    };
+    svr.Post("/shader", shader_request);
+    svr.Delete("/shader", shader_request);
+
+    svr.Get("/status", [&](const httplib::Request& req, httplib::Response& res) {
+        set_cors(res);
+        std::shared_ptr<const StatusSnapshot> snap = status_snapshot();
+        res.set_header("ETag", snap->etag);
+        res.set_header("Cache-Control", "no-cache");
+        const std::string inm = req.get_header_value("If-None-Match");
+        if (!inm.empty() && (inm == "*" || inm.find(snap->etag) != std::string::npos)) {
+            g_statusNotModified++;
+            res.status = 304;
+            return;
+        }
+        g_statusFull++;
+        res.set_content(snap->json, "application/json");
+    });
+
+    svr.Get("/health", [&](const httplib::Request&, httplib::Response& res) {
+        set_cors(res);
+        auto uptime = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - start_time).count();
+        const int phase = g_startPhase.load();
+        res.set_content(std::string("{\"ok\":true,\"ready\":") + (phase == PHASE_RENDERING ? "true" : "false")
+                        + ",\"phase\":\"" + START_PHASE_NAMES[phase] + "\",\"uptime\":" + std::to_string(uptime) + "}", "application/json");
+    });
+
+    auto config_json = [](const LiveConfig &lc) {
+        std::ostringstream json;
+        json << "{\"width\":" << W << ",\"height\":" << H << ",\"segments\":" << g_cfg.segments << ",\"blankInterval\":" << g_cfg.blankInterval
+             << ",\"animStep\":" << lc.animStep << ",\"targetFps\":" << lc.targetFps
+             << ",\"grayStart\":" << lc.grayStart << ",\"grayEnd\":" << lc.grayEnd << "}";
+        return json.str();
+    };
+
+    svr.Get("/config", [&](const httplib::Request&, httplib::Response& res) {
+        set_cors(res);
+        LiveConfig lc;
+        {
+            std::lock_guard<std::mutex> lk(config_mtx);
+            lc = g_liveConfig;
+        }
+        res.set_content(config_json(lc), "application/json");
+    });
+
+    svr.Post("/config", [&](const httplib::Request& req, httplib::Response& res) {
+        set_cors(res);
+        if (req.get_header_value("X-API-Token") != g_cfg.apiToken) { res.status = 401; return; }
+
+        LiveConfig lc;
+        {
+            std::lock_guard<std::mutex> lk(config_mtx);
+            lc = g_liveConfig;
+            const char *err = nullptr;
+            if (!parse_live_config_json(req.body.data(), req.body.size(), lc, err)) {
+                res.status = 400; res.set_content(err, "text/plain"); return;
+            }
+            lc.generation++;
+            g_liveConfig = lc;
+            g_liveConfigBuf.back() = lc;
+            g_liveConfigBuf.publish();
+        }
+        log_ts("API: Config (fps=" + std::to_string(lc.targetFps) + ", animStep=" + fmt_float(lc.animStep)
+               + ", gray=" + fmt_float(lc.grayStart) + ".." + fmt_float(lc.grayEnd) + " s)");
+        res.set_content(config_json(lc), "application/json");
+    });
+
+    svr.Get("/metrics", [&](const httplib::Request&, httplib::Response& res) {
+        set_cors(res);
+        res.set_content(metrics_to_prometheus(), "text/plain; version=0.0.4");
+    });
+
+    // Streams live on their own port (see startStreamServer()); send viewers there
+    auto stream_redirect = [&](const httplib::Request& req, httplib::Response& res) {
+        std::string host = req.get_header_value("Host");
+        size_t colon = host.rfind(':');
+        if (colon != std::string::npos && host.find(']', colon) == std::string::npos) host.erase(colon);
+        if (host.empty()) { res.status = 404; return; }
+        res.status = 302;
+        res.set_header("Location", "http://" + host + ":" + std::to_string(g_cfg.streamPort) + req.path);
+    };
+    if (g_cfg.streamPort != 0) {
+        svr.Get("/preview", stream_redirect);
+        svr.Get("/preview.jpg", stream_redirect);
+        svr.Get("/events", stream_redirect);
+    }
+
+    log_ts("API: Listening on port " + std::to_string(g_cfg.apiPort));
+    g_apiUpMs = ms_since(start_time);
+    svr.listen("0.0.0.0", g_cfg.apiPort);
+}
+
+// =======================================================
+// UDP API
+// =======================================================
+/**
+ * Binary update channel for high-rate telemetry. One datagram carries one
+ * UdpUpdatePacket (little-endian, a 40-byte header followed by at least
+ * nseg floats) and goes through the same apply_update() path as POST /update.
+ *
+ * `fields` uses the UpdateFields::F_* bits, so a packet only changes what it
+ * flags. `token` is the 32-bit FNV-1a hash of the API token. Packets whose `seq`
+ * is not newer than the last accepted one (serial-number arithmetic, so it
+ * may wrap) are dropped as out of order; after UDP_SEQ_RESET_SEC of silence
+ * any seq is accepted again so a restarted sender doesn't have to persist it.
+ */
+static const uint32_t UDP_MAGIC = 0x4255434C;   // "LCUB"
+static const uint8_t  UDP_VERSION = 1;
+static const uint8_t  UDP_TYPE_UPDATE = 1;
+static const float    UDP_SEQ_RESET_SEC = 1.0f;
+
+struct UdpUpdatePacket {
+    uint32_t magic;
+    uint8_t  version;
+    uint8_t  type;
+    uint16_t fields;                // UpdateFields::F_* presence bits
+    uint32_t seq;
+    uint32_t token;                 // fnv1a32(api token)
+    uint8_t  mode;                  // 0: heat, 1: custom
+    uint8_t  geometry;              // index into GEOM_NAMES
+    uint8_t  nseg;                  // leading entries of segment[] that are valid
+    uint8_t  reserved0;
+    float    colour;
+    float    width;
+    float    percent;
+    uint8_t  elementColor[3];       // RGB8
+    uint8_t  backgroundColor[3];    // RGB8
+    uint16_t reserved1;
+    float    segment[MAX_SEGMENTS];     // only the first nseg are sent
+};
+static const size_t UDP_HEADER_BYTES = 40;
+static_assert(offsetof(UdpUpdatePacket, segment) == UDP_HEADER_BYTES, "UdpUpdatePacket must stay unpadded");
+
+/**
+ * False if a float the packet carries is NaN or infinite. clamp() lets NaN
+ * through, and one NaN target would poison every later interpolation step.
+ */
+static bool udp_packet_finite(const UdpUpdatePacket &p) {
+    if (!std::isfinite(p.colour) || !std::isfinite(p.width) || !std::isfinite(p.percent)) return false;
+    for (int i = 0; i < p.nseg; i++)
+        if (!std::isfinite(p.segment[i])) return false;
+    return true;
+}
+
+/** Converts a validated packet into the fields of an equivalent /update request. */
+static void udp_packet_to_fields(const UdpUpdatePacket &p, UpdateFields &f) {
+    f.present = p.fields & 0xFF;
+    snprintf(f.mode, sizeof(f.mode), "%s", p.mode == 0 ? "heat" : "custom");
+    f.colour = p.colour;
+    f.geometryMode = p.geometry < NUM_GEOMETRIES ? p.geometry : -1;
+    f.nseg = p.nseg < g_cfg.segments ? p.nseg : g_cfg.segments;
+    memcpy(f.segment, p.segment, sizeof(f.segment));
+    f.width = p.width;
+    f.percent = p.percent;
+    for (int k = 0; k < 3; k++) {
+        f.elementColorRGB[k] = p.elementColor[k] / 255.0f;
+        f.backgroundColorRGB[k] = p.backgroundColor[k] / 255.0f;
+    }
+}
+
+void startUdpApi() {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) { log_ts("UDP: socket() failed: " + std::string(strerror(errno))); return; }
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(g_cfg.udpPort);
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+        log_ts("UDP: bind() failed: " + std::string(strerror(errno)));
+        close(fd);
+        return;
+    }
+
+    const uint32_t tokenHash = fnv1a32(g_cfg.apiToken.data(), g_cfg.apiToken.size());
+    bool haveSeq = false;
+    uint32_t lastSeq = 0;
+    auto lastPacket = std::chrono::steady_clock::now();
+
+    log_ts("UDP: Listening on port " + std::to_string(g_cfg.udpPort));
+    while (!interrupt_received) {
+        // Poll with a timeout so shutdown doesn't need to unblock recv()
+        pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 200) <= 0) continue;
+
+        UdpUpdatePacket pkt;
+        ssize_t n = recv(fd, &pkt, sizeof(pkt), 0);
+        if (n < (ssize_t)UDP_HEADER_BYTES || pkt.magic != UDP_MAGIC || pkt.version != UDP_VERSION
+            || pkt.type != UDP_TYPE_UPDATE || pkt.token != tokenHash
+            || pkt.nseg > MAX_SEGMENTS || (size_t)n < UDP_HEADER_BYTES + 4 * (size_t)pkt.nseg
+            || !udp_packet_finite(pkt)) {
+            g_udpRejected++;
+            continue;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        bool reset = std::chrono::duration<float>(now - lastPacket).count() > UDP_SEQ_RESET_SEC;
+        if (haveSeq && !reset && (int32_t)(pkt.seq - lastSeq) <= 0) {
+            g_udpStale++;
+            continue;
+        }
+        if (!haveSeq || reset) log_ts("UDP: Stream started (seq " + std::to_string(pkt.seq) + ")");
+        haveSeq = true;
+        lastSeq = pkt.seq;
+        lastPacket = now;
+
+        UpdateFields f;
+        udp_packet_to_fields(pkt, f);
+        if (commit_update(f, nullptr)) g_udpAccepted++;
+        else g_udpRejected++;
+    }
+    close(fd);
+}
+
+// =======================================================
+// FLEET SYNC (multicast)
+// =======================================================
+/**
+ * Keeps several cubes in lockstep. The leader multicasts a SyncPacket with
+ * its animation clock `t` and its current target, whichever channel set it:
+ * SYNC_HZ times per second as a heartbeat, and at once whenever the target
+ * changes (a burst within SYNC_MIN_GAP_MS coalesced into one), so one push
+ * reaches the whole fleet as one datagram. Any process
+ * that sends the same packet can lead.
+ *
+ * Followers install the target whenever the leader's `generation` moves
+ * (a lost packet is repaired by the next heartbeat) and phase-lock their
+ * own `t`: the render loop compares it with the leader clock extrapolated
+ * from the newest packet and slews by at most SYNC_SLEW of the frame time,
+ * or steps when the error exceeds SYNC_STEP_SEC (start-up, leader restart).
+ * Without packets for SYNC_TIMEOUT_SEC a follower free-runs until the
+ * leader is back. Signal age is derived from the shared clock, so fades and
+ * blanking line up to within a frame. Timelines are not relayed; the leader
+ * sends the target a timeline ends on.
+ *
+ * Little-endian, an 80-byte header followed by at least nseg floats; magic,
+ * version and token as for UdpUpdatePacket, seq checked the same way.
+ */
+static const uint8_t  UDP_TYPE_SYNC = 2;
+static const int      SYNC_HZ = 10;
+static const float    SYNC_STEP_SEC = 0.25f;
+static const float    SYNC_GAIN = 0.5f;         // fraction of the clock error corrected per second
+static const float    SYNC_SLEW = 0.02f;        // max correction, relative to dt
+static const float    SYNC_TIMEOUT_SEC = 2.0f;
+static const int      SYNC_MIN_GAP_MS = 25;     // a burst of updates goes out as one packet per gap
+
+struct SyncPacket {
+    uint32_t magic;
+    uint8_t  version;
+    uint8_t  type;
+    uint8_t  nseg;                  // leading entries of segment[] that are valid
+    uint8_t  flags;                 // SYNC_F_* bits
+    uint32_t seq;
+    uint32_t token;                 // fnv1a32(api token)
+    uint32_t generation;            // changes whenever the leader's target does
+    float    clock;                 // leader t when sent (s)
+    float    colour;
+    float    width;
+    float    percent;
+    int32_t  geometry;              // index into GEOM_NAMES
+    float    elementColor[3];
+    float    backgroundColor[3];
+    char     mode[16];              // "heat" or "custom", NUL-terminated
+    float    segment[MAX_SEGMENTS];     // only the first nseg are sent
+};
+static const uint8_t SYNC_F_ELEMENT_COLOR = 1, SYNC_F_BACKGROUND_COLOR = 2;
+static const size_t SYNC_HEADER_BYTES = 80;
+static_assert(offsetof(SyncPacket, segment) == SYNC_HEADER_BYTES, "SyncPacket must stay unpadded");
+
+// False if any float of the packet is NaN or infinite (clamp() would let NaN into the clock or the target)
+static bool sync_packet_finite(const SyncPacket &p) {
+    float v[] = { p.clock, p.colour, p.width, p.percent, p.elementColor[0], p.elementColor[1], p.elementColor[2],
+                  p.backgroundColor[0], p.backgroundColor[1], p.backgroundColor[2] };
+    for (float x : v)
+        if (!std::isfinite(x)) return false;
+    for (int i = 0; i < p.nseg; i++)
+        if (!std::isfinite(p.segment[i])) return false;
+    return true;
+}
+
+// Follower: the leader's target replaces ours (and any local timeline), clamped like apply_update()
+static void commit_sync_target(const SyncPacket &p) {
+    std::lock_guard<std::mutex> lk(target_mtx);
+    VisualState &ts = g_target;
+    stop_timeline_locked();
+    ts.colourLevel = compat::clamp(p.colour, 0.0f, 100.0f);
+    ts.elementWidth = compat::clamp(p.width, 0.0f, 100.0f);
+    ts.percent = compat::clamp(p.percent, 0.0f, 1.0f);
+    if (p.geometry >= 0 && p.geometry < NUM_GEOMETRIES) ts.geometryMode = p.geometry;
+    for (int k = 0; k < 3; k++) {
+        ts.elementColorRGB[k] = compat::clamp(p.elementColor[k], 0.0f, 1.0f);
+        ts.backgroundColorRGB[k] = compat::clamp(p.backgroundColor[k], 0.0f, 1.0f);
+    }
+    ts.haveElementColor = p.flags & SYNC_F_ELEMENT_COLOR;
+    ts.haveBackgroundColor = p.flags & SYNC_F_BACKGROUND_COLOR;
+    memcpy(ts.mode, p.mode, sizeof(ts.mode));
+    ts.mode[sizeof(ts.mode) - 1] = '\0';
+    for (int i = 0; i < p.nseg && i < g_cfg.segments; i++) ts.segment[i] = compat::clamp(p.segment[i], 0.0f, 100.0f);
+    stage_target_locked();
+}
+
+/**
+ * Render thread, follower: the correction to add to t this frame. Sets
+ * `stepped` when it jumps to the leader clock instead of slewing towards it.
+ */
+static float sync_correction(float t, float dt, std::chrono::steady_clock::time_point now, bool &stepped) {
+    stepped = false;
+    const SyncClock &leader = g_leaderClockBuf.read();
+    if (leader.seq == 0 || std::chrono::duration<float>(now - leader.at).count() > SYNC_TIMEOUT_SEC) return 0.0f;
+    float err = leader.clock + std::chrono::duration<float>(now - leader.at).count() - t;
+    g_syncOffsetUs = (int32_t)(err * 1e6f);
+    if (fabsf(err) > SYNC_STEP_SEC) {
+        stepped = true;
+        g_syncSteps++;
+        return err;
+    }
+    return compat::clamp(err * SYNC_GAIN * dt, -SYNC_SLEW * dt, SYNC_SLEW * dt);
+}
+
+static bool sync_group_addr(sockaddr_in &addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(g_cfg.syncPort);
+    return inet_aton(g_cfg.syncGroup.c_str(), &addr.sin_addr) != 0;
+}
+
+void startSyncLeader() {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) { log_ts("SYNC: socket() failed: " + std::string(strerror(errno))); return; }
+    unsigned char ttl = 1;      // stay on the local network
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    sockaddr_in dst;
+    sync_group_addr(dst);
+
+    SyncPacket pkt;
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.magic = UDP_MAGIC;
+    pkt.version = UDP_VERSION;
+    pkt.type = UDP_TYPE_SYNC;
+    pkt.token = fnv1a32(g_cfg.apiToken.data(), g_cfg.apiToken.size());
+    pkt.nseg = (uint8_t)g_cfg.segments;
+    const size_t len = SYNC_HEADER_BYTES + 4 * (size_t)g_cfg.segments;
+    bool failing = false;
+    auto lastSend = std::chrono::steady_clock::now();
+
+    log_ts("SYNC: Leading " + g_cfg.syncGroup + ":" + std::to_string(g_cfg.syncPort) + " at " + std::to_string(SYNC_HZ) + " Hz");
+    while (!interrupt_received) {
+        // Heartbeat, or at once when the target changes
+        {
+            std::unique_lock<std::mutex> lk(sync_mtx);
+            sync_cv.wait_for(lk, std::chrono::milliseconds(1000 / SYNC_HZ), [] { return sync_dirty; });
+            sync_dirty = false;
+        }
+        auto since = std::chrono::steady_clock::now() - lastSend;
+        if (since < std::chrono::milliseconds(SYNC_MIN_GAP_MS))
+            std::this_thread::sleep_for(std::chrono::milliseconds(SYNC_MIN_GAP_MS) - since);
+        const SyncClock &local = g_localClockBuf.read();
+        if (local.seq == 0) continue;     // render loop not running yet
+
+        {
+            std::lock_guard<std::mutex> lk(target_mtx);
+            const VisualState &ts = g_target;
+            pkt.generation = ts.generation;
+            pkt.colour = ts.colourLevel;
+            pkt.width = ts.elementWidth;
+            pkt.percent = ts.percent;
+            pkt.geometry = ts.geometryMode;
+            memcpy(pkt.elementColor, ts.elementColorRGB, sizeof(pkt.elementColor));
+            memcpy(pkt.backgroundColor, ts.backgroundColorRGB, sizeof(pkt.backgroundColor));
+            pkt.flags = (ts.haveElementColor ? SYNC_F_ELEMENT_COLOR : 0) | (ts.haveBackgroundColor ? SYNC_F_BACKGROUND_COLOR : 0);
+            memcpy(pkt.mode, ts.mode, sizeof(pkt.mode));
+            memcpy(pkt.segment, ts.segment, 4 * (size_t)g_cfg.segments);
+        }
+        pkt.seq++;
+        lastSend = std::chrono::steady_clock::now();
+        pkt.clock = local.clock + std::chrono::duration<float>(lastSend - local.at).count();
+        if (sendto(fd, &pkt, len, 0, (sockaddr *)&dst, sizeof(dst)) < 0) {
+            if (!failing) log_ts("SYNC: sendto() failed: " + std::string(strerror(errno)));
+            failing = true;
+        } else {
+            failing = false;
+            g_syncSent++;
+        }
+    }
+    close(fd);
+}
+
+void startSyncFollower() {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) { log_ts("SYNC: socket() failed: " + std::string(strerror(errno))); return; }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));   // several followers on one host
+
+    sockaddr_in addr;
+    sync_group_addr(addr);
+    ip_mreq mreq;
+    mreq.imr_multiaddr = addr.sin_addr;
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0
+        || setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+        log_ts("SYNC: Cannot join " + g_cfg.syncGroup + ": " + std::string(strerror(errno)));
+        close(fd);
+        return;
+    }
+
+    const uint32_t tokenHash = fnv1a32(g_cfg.apiToken.data(), g_cfg.apiToken.size());
+    bool following = false;
+    uint32_t lastSeq = 0, lastGeneration = 0;
+    uint32_t clockSeq = 0;
+    auto lastPacket = std::chrono::steady_clock::now();
+
+    log_ts("SYNC: Following " + g_cfg.syncGroup + ":" + std::to_string(g_cfg.syncPort));
+    while (!interrupt_received) {
+        pollfd pfd = { fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, 200);
+        auto now = std::chrono::steady_clock::now();
+        bool lost = std::chrono::duration<float>(now - lastPacket).count() > SYNC_TIMEOUT_SEC;
+        if (following && lost) {
+            log_ts("SYNC: Leader lost, free-running");
+            following = false;
+        }
+        if (ready <= 0) continue;
+
+        SyncPacket pkt;
+        ssize_t n = recv(fd, &pkt, sizeof(pkt), 0);
+        if (n < (ssize_t)SYNC_HEADER_BYTES || pkt.magic != UDP_MAGIC || pkt.version != UDP_VERSION
+            || pkt.type != UDP_TYPE_SYNC || pkt.token != tokenHash
+            || pkt.nseg > MAX_SEGMENTS || (size_t)n < SYNC_HEADER_BYTES + 4 * (size_t)pkt.nseg
+            || !sync_packet_finite(pkt)) {
+            g_syncRejected++;
+            continue;
+        }
+        if (following && (int32_t)(pkt.seq - lastSeq) <= 0) {
+            g_syncStale++;
+            continue;
+        }
+        lastSeq = pkt.seq;
+        lastPacket = now;
+        g_syncAccepted++;
+
+        SyncClock &c = g_leaderClockBuf.back();
+        c.clock = pkt.clock;
+        c.at = now;
+        c.seq = ++clockSeq;
+        g_leaderClockBuf.publish();
+
+        if (!following || pkt.generation != lastGeneration) commit_sync_target(pkt);
+        lastGeneration = pkt.generation;
+        if (!following) log_ts("SYNC: Locked to leader (seq " + std::to_string(pkt.seq) + ")");
+        following = true;
+    }
+    close(fd);
+}
+
+// =======================================================
+// STREAM PORT (MJPEG preview, status events)
+// =======================================================
+/**
+ * Live preview of what the matrix shows, for operators away from the cube.
+ *
+ * Whoever hands a frame to the canvas calls g_preview.offer(). At most
+ * preview-fps times per second that copies the frame into a shared buffer
+ * (a try-lock: if the preview thread holds it, the tick is skipped) and wakes
+ * the preview thread through a pipe. Everything else happens on that one
+ * thread: while anyone is watching it maps the frame into matrix order,
+ * box-downscales it by preview-scale and encodes one JPEG per tick. Every
+ * client is then handed the same reference-counted multipart chunk. Sockets
+ * are non-blocking and multiplexed with poll(), so a viewer never holds an
+ * httplib pool thread, and a slow viewer finishes its current frame and
+ * then skips to the newest one.
+ *
+ * The same thread pushes the status snapshot as Server-Sent Events: once per
+ * STATUS_HZ tick it fetches status_snapshot() and, if its seq moved, hands
+ * every subscriber one shared event. A subscriber still sending the previous
+ * event skips to the newest, like a slow preview viewer.
+ *
+ *   GET /preview      multipart/x-mixed-replace MJPEG stream
+ *   GET /preview.jpg  the current frame
+ *   GET /events       text/event-stream of the /status body
+ *
+ * The REST API redirects all three paths here.
+ */
+class PreviewSource {
+public:
+    // Before any producer runs; false if the wake pipe cannot be created
+    bool init(int fps) {
+        period_ = std::chrono::microseconds(1000000 / fps);
+        if (pipe(wake_) != 0) return false;
+        for (int fd : wake_) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        return true;
+    }
+
+    int wake_fd() const { return wake_[0]; }
+
+    // Frame producer: a rate-limited copy, never waits for the preview thread
+    void offer(const unsigned char *pixels, int bpp) {
+        if (wake_[1] < 0) return;
+        auto now = std::chrono::steady_clock::now();
+        if (now < next_) return;
+        next_ = now + period_;
+        std::unique_lock<std::mutex> lk(mtx_, std::try_to_lock);
+        if (!lk.owns_lock()) return;
+        raw_.assign(pixels, pixels + (size_t)W * H * bpp);
+        bpp_ = bpp;
+        fresh_ = true;
+        lk.unlock();
+        char c = 1;
+        if (write(wake_[1], &c, 1) < 0) { /* pipe full: the preview thread is awake anyway */ }
+    }
+
+    // Preview thread: the last offered frame as matrix-order RGB, downscaled by
+    // `scale`; only if it is new since the last call unless `force`
+    bool take(int scale, bool force, std::vector<uint8_t> &img) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (raw_.empty() || (!fresh_ && !force)) return false;
+        fresh_ = false;
+        const int pw = W / scale, ph = H / scale, bpp = bpp_;
+        std::vector<uint32_t> acc((size_t)pw * ph * 3, 0);
+        for (int gl_y = 0; gl_y < H; gl_y++) {
+            const unsigned char *src = raw_.data() + (size_t)gl_y * W * bpp;
+            const int py = lut_dst_y[gl_y] / scale;
+            for (int x = 0; x < W; x++, src += bpp) {
+                uint32_t *d = &acc[((size_t)py * pw + lut_dst_x[x] / scale) * 3];
+                d[0] += src[0]; d[1] += src[1]; d[2] += src[2];
+            }
+        }
+        const uint32_t n = scale * scale;
+        img.resize(acc.size());
+        for (size_t i = 0; i < acc.size(); i++) img[i] = (uint8_t)((acc[i] + n / 2) / n);
+        return true;
+    }
+
+private:
+    int wake_[2] = { -1, -1 };
+    std::chrono::microseconds period_{200000};
+    std::chrono::steady_clock::time_point next_;    // producer only
+    std::mutex mtx_;
+    std::vector<unsigned char> raw_;
+    int bpp_ = 4;
+    bool fresh_ = false;
+};
+
+static PreviewSource g_preview;
+
+static const int STREAM_MAX_CLIENTS = 16;
+static const int STREAM_REQUEST_TIMEOUT_SEC = 5;
+static const char PREVIEW_BOUNDARY[] = "ledcubeframe";
+
+struct StreamClient {
+    int fd = -1;
+    std::string request;                        // until the blank line
+    bool stream = false;                        // GET /preview
+    bool snapshot = false;                      // GET /preview.jpg, waiting for a frame
+    bool events = false;                        // GET /events
+    bool closeWhenSent = false;
+    std::string head;                           // per-client bytes to send first
+    std::shared_ptr<const std::string> body;    // shared frame bytes after head
+    size_t off = 0;                             // sent bytes of head + body
+    uint64_t partSeq = 0;                       // last stream part started
+    uint64_t statusSeq = 0;                     // last status event started
+    std::chrono::steady_clock::time_point since;
+
+    bool pending() const { return off < head.size() + (body ? body->size() : 0); }
+};
+
+// Sends as much as the socket takes; false when the client is gone or done
+static bool stream_flush(StreamClient &c) {
+    while (c.pending()) {
+        const char *p;
+        size_t n;
+        if (c.off < c.head.size()) { p = c.head.data() + c.off; n = c.head.size() - c.off; }
+        else { p = c.body->data() + (c.off - c.head.size()); n = c.body->size() - (c.off - c.head.size()); }
+        ssize_t k = send(c.fd, p, n, MSG_NOSIGNAL);
+        if (k < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        c.off += (size_t)k;
+    }
+    c.head.clear();
+    c.body.reset();
+    c.off = 0;
+    return !c.closeWhenSent;
+}
+
+void startStreamServer() {
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (lfd < 0) { log_ts("STREAM: socket() failed: " + std::string(strerror(errno))); return; }
+    int one = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(g_cfg.streamPort);
+    if (bind(lfd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 8) < 0) {
+        log_ts("STREAM: bind() failed: " + std::string(strerror(errno)));
+        close(lfd);
+        return;
+    }
+    fcntl(lfd, F_SETFL, fcntl(lfd, F_GETFL) | O_NONBLOCK);
+
+    std::vector<StreamClient> clients;
+    std::vector<uint8_t> img;
+    std::shared_ptr<const std::string> jpg, part;    // newest frame, alone and as a multipart chunk
+    uint64_t partSeq = 0;
+    std::shared_ptr<const std::string> event;       // newest status snapshot as an SSE event
+    uint64_t eventSeq = 0;
+    auto nextStatus = std::chrono::steady_clock::now();
+    const int pw = W / g_cfg.previewScale, ph = H / g_cfg.previewScale;
+
+    log_ts("STREAM: Preview " + std::to_string(pw) + "x" + std::to_string(ph) + " at " + std::to_string(g_cfg.previewFps)
+           + " fps, status events at " + std::to_string(STATUS_HZ) + " Hz on port " + std::to_string(g_cfg.streamPort));
+    std::vector<pollfd> pfds;
+    while (!interrupt_received) {
+        pfds.clear();
+        pfds.push_back({ lfd, POLLIN, 0 });
+        pfds.push_back({ g_preview.wake_fd(), POLLIN, 0 });
+        for (const StreamClient &c : clients)
+            pfds.push_back({ c.fd, (short)(POLLIN | (c.pending() ? POLLOUT : 0)), 0 });
+        if (poll(pfds.data(), pfds.size(), 1000 / STATUS_HZ) < 0 && errno != EINTR) break;
+
+        bool newViewer = false;
+        for (size_t i = 0; i < clients.size(); i++) {
+            StreamClient &c = clients[i];
+            const short rev = pfds[i + 2].revents;
+            bool keep = !(rev & (POLLERR | POLLNVAL));
+            if (keep && (rev & (POLLIN | POLLHUP))) {
+                char buf[512];
+                ssize_t k = recv(c.fd, buf, sizeof(buf), 0);
+                if (k == 0 || (k < 0 && errno != EAGAIN && errno != EINTR)) keep = false;
+                else if (k > 0 && !c.stream && !c.snapshot && !c.events && !c.closeWhenSent) {
+                    c.request.append(buf, (size_t)k);
+                    if (c.request.find("\r\n\r\n") != std::string::npos) {
+                        // Request line: GET <path>[?query] HTTP/1.x
+                        std::string path;
+                        if (c.request.compare(0, 4, "GET ") == 0)
+                            path = c.request.substr(4, c.request.find_first_of(" ?\r", 4) - 4);
+                        if (path == "/preview") {
+                            c.stream = true;
+                            c.head = std::string("HTTP/1.1 200 OK\r\nContent-Type: multipart/x-mixed-replace; boundary=")
+                                   + PREVIEW_BOUNDARY + "\r\nCache-Control: no-cache\r\nAccess-Control-Allow-Origin: *\r\n"
+                                   + "Connection: close\r\n\r\n";
+                            newViewer = true;
+                        } else if (path == "/preview.jpg") {
+                            c.snapshot = true;
+                            newViewer = true;
+                        } else if (path == "/events") {
+                            c.events = true;
+                            c.head = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n"
+                                     "Access-Control-Allow-Origin: *\r\nConnection: close\r\n\r\nretry: 2000\n\n";
+                        } else {
+                            c.head = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+                            c.closeWhenSent = true;
+                        }
+                        c.request.clear();
+                    } else if (c.request.size() > 4096) {
+                        keep = false;
+                    }
+                }
+            }
+            if (keep && !c.stream && !c.snapshot && !c.events && !c.closeWhenSent
+                && std::chrono::steady_clock::now() - c.since > std::chrono::seconds(STREAM_REQUEST_TIMEOUT_SEC))
+                keep = false;
+            if (keep && (rev & POLLOUT)) keep = stream_flush(c);
+            if (!keep) { close(c.fd); c.fd = -1; }
+        }
+        clients.erase(std::remove_if(clients.begin(), clients.end(), [](const StreamClient &c) { return c.fd < 0; }), clients.end());
+
+        // New connections
+        if (pfds[0].revents & POLLIN) {
+            for (int fd; (fd = accept(lfd, nullptr, nullptr)) >= 0; ) {
+                if ((int)clients.size() >= STREAM_MAX_CLIENTS) {
+                    static const char busy[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+                    if (send(fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL) < 0) { /* dropped anyway */ }
+                    close(fd);
+                    continue;
+                }
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                StreamClient c;
+                c.fd = fd;
+                c.since = std::chrono::steady_clock::now();
+                clients.push_back(c);
+            }
+        }
+
+        // Encode once per tick while anyone watches; a new viewer gets the current frame at once
+        if (pfds[1].revents & POLLIN) {
+            char drain[64];
+            while (read(g_preview.wake_fd(), drain, sizeof(drain)) > 0) {}
+        }
+        int viewers = 0;
+        for (const StreamClient &c : clients) viewers += c.stream || c.snapshot;
+        if (viewers > 0 && g_preview.take(g_cfg.previewScale, newViewer, img)) {
+            jpg = std::make_shared<const std::string>(jpeg::encode(img.data(), pw, ph, g_cfg.previewQuality));
+            part = std::make_shared<const std::string>(std::string("--") + PREVIEW_BOUNDARY
+                + "\r\nContent-Type: image/jpeg\r\nContent-Length: " + std::to_string(jpg->size()) + "\r\n\r\n" + *jpg + "\r\n");
+            partSeq++;
+            g_previewFrames++;
+        }
+
+        // Status events: one snapshot per tick while anyone subscribes, one event per change
+        int subscribers = 0;
+        for (const StreamClient &c : clients) subscribers += c.events;
+        auto now = std::chrono::steady_clock::now();
+        if (subscribers > 0 && now >= nextStatus) {
+            nextStatus = now + std::chrono::milliseconds(1000 / STATUS_HZ);
+            std::shared_ptr<const StatusSnapshot> snap = status_snapshot();
+            if (snap->seq != eventSeq) {
+                event = std::make_shared<const std::string>("id: " + std::to_string(snap->seq) + "\ndata: " + snap->json + "\n\n");
+                eventSeq = snap->seq;
+            }
+        }
+
+        // Fan out: idle stream clients start the newest chunk, waiting snapshots get the frame
+        for (StreamClient &c : clients) {
+            if (c.events && event && c.statusSeq != eventSeq) {
+                if (c.pending() && c.body) continue;    // still sending an older event
+                c.body = event;
+                c.statusSeq = eventSeq;
+            } else if (c.stream && part && c.partSeq != partSeq) {
+                if (c.pending() && c.body) continue;    // still sending an older frame
+                c.body = part;
+                c.partSeq = partSeq;
+            } else if (c.snapshot && jpg) {
+                c.head = "HTTP/1.1 200 OK\r\nContent-Type: image/jpeg\r\nContent-Length: " + std::to_string(jpg->size())
+                       + "\r\nCache-Control: no-cache\r\nAccess-Control-Allow-Origin: *\r\nConnection: close\r\n\r\n";
+                c.body = jpg;
+                c.snapshot = false;
+                c.closeWhenSent = true;
+            } else {
+                continue;
+            }
+            if (!stream_flush(c)) { close(c.fd); c.fd = -1; }
+        }
+        clients.erase(std::remove_if(clients.begin(), clients.end(), [](const StreamClient &c) { return c.fd < 0; }), clients.end());
+
+        int streaming = 0;
+        for (const StreamClient &c : clients) streaming += c.stream;
+        g_previewClients = streaming;
+        g_eventClients = subscribers;
+    }
+    for (StreamClient &c : clients) close(c.fd);
+    close(lfd);
+}
+
+#ifdef LEDCUBE_BENCHMARK
+// =======================================================
+// BENCHMARK DRIVER (-DLEDCUBE_BENCHMARK)
+// =======================================================
+/**
+ * Scripted scenarios for the benchmark build, driven by the render loop's
+ * frame number. Animation time advances by BENCH_DT per frame instead of
+ * wall time, and every update lands on a fixed frame, so two runs render
+ * the same frame sequence however fast they go. Each scenario applies its
+ * /update body through the same parse/commit path as the REST handler, lets
+ * the transitions run for BENCH_WARMUP_FRAMES and then measures bench-frames
+ * frames. "replay" posts one update per frame: the lines of the bench-replay
+ * file if one is given, otherwise synthetic heat traffic with moving segment
+ * levels.
+ *
+ * One line per scenario goes to stdout (the log stays on stderr): frames per
+ * second, p50/p99 frame work and the mean milliseconds spent in each stage.
+ *
+ * With bench-golden=PATH the captured frames of the measured windows are
+ * compared against a capture file of an earlier run (e.g. a baseline build,
+ * or bg-scale=1), and a mean/max error and PSNR line per scenario follows
+ * the timing table.
+ */
+struct BenchScenario {
+    const char *name;
+    const char *body;   // applied on the first frame of the scenario
+    bool replay;        // post an update every frame
+};
+
+#define BENCH_CUSTOM(geom, width, percent) \
+    "{\"mode\":\"custom\",\"geometry\":\"" geom "\",\"width\":" #width ",\"percent\":" #percent \
+    ",\"elementColor\":\"#00ff00\",\"backgroundColor\":\"#110022\"}"
+
+static const BenchScenario BENCH_SCENARIOS[] = {
+    { "heat",      "{\"mode\":\"heat\",\"colour\":15,\"width\":47,\"percent\":0.74}", false },
+    { "heat-full", "{\"mode\":\"heat\",\"colour\":80,\"width\":47,\"percent\":1}",    false },
+    { "ring",      BENCH_CUSTOM("ring", 60, 0.5),     false },
+    { "circle",    BENCH_CUSTOM("circle", 60, 0.5),   false },
+    { "square",    BENCH_CUSTOM("square", 60, 0.5),   false },
+    { "triangle",  BENCH_CUSTOM("triangle", 60, 0.5), false },
+    { "x",         BENCH_CUSTOM("x", 60, 0.5),        false },
+    { "thin",      BENCH_CUSTOM("ring", 5, 0.1),      false },
+    { "x-full",    BENCH_CUSTOM("x", 100, 1),         false },
+    { "replay",    nullptr,                            true },
+};
+static const int BENCH_SCENARIO_COUNT = sizeof(BENCH_SCENARIOS) / sizeof(BENCH_SCENARIOS[0]);
+static const int BENCH_WARMUP_FRAMES = 40;
+
+class BenchRunner {
+public:
+    // Prepares replay traffic and the golden comparison (hooks g_capture.inspect)
+    bool init() {
+        if (!g_cfg.benchReplay.empty()) {
+            std::ifstream in(g_cfg.benchReplay);
+            for (std::string line; std::getline(in, line); )
+                if (!trim(line).empty()) replay_.push_back(line);
+            log_ts("BENCH: Replaying " + std::to_string(replay_.size()) + " update(s) from " + g_cfg.benchReplay);
+        }
+        if (!g_cfg.benchGolden.empty()) {
+            golden_ = fopen(g_cfg.benchGolden.c_str(), "rb");
+            CaptureHeader h;
+            if (!golden_ || fread(&h, sizeof(h), 1, golden_) != 1 || memcmp(h.magic, CAPTURE_MAGIC, sizeof(h.magic)) != 0
+                || (int)h.width != W || (int)h.height != H || (h.bpp != 3 && h.bpp != 4)) {
+                log_ts("BENCH: " + g_cfg.benchGolden + " is not a " + std::to_string(W) + "x" + std::to_string(H) + " capture file");
+                return false;
+            }
+            goldenBpp_ = h.bpp;
+            goldenPixels_.resize((size_t)W * H * h.bpp);
+            g_capture.inspect = [this](const unsigned char *px, uint32_t seq) { compare(px, seq); };
+        }
+
+        printf("%-10s %8s %8s %8s", "scenario", "fps", "p50_ms", "p99_ms");
+        for (int st = 0; st < STAGE_SLEEP; st++) printf(" %8s", STAGE_NAMES[st]);
+        printf("\n");
+        fflush(stdout);
+        return true;
+    }
+
+    bool golden() const { return golden_ != nullptr; }
+
+    // Render thread, at the start of frame n: posts the scripted updates; false once all scenarios ran
+    bool frame(uint32_t n) {
+        const uint32_t per = BENCH_WARMUP_FRAMES + g_cfg.benchFrames;
+        const int sc = (int)(n / per);
+        const uint32_t k = n % per;
+        if (k == 0 && sc > 0) report(sc - 1);
+        if (sc >= BENCH_SCENARIO_COUNT) return false;
+
+        const BenchScenario &s = BENCH_SCENARIOS[sc];
+        if (k == 0 && s.body && !post(s.body)) log_ts(std::string("BENCH: ") + s.name + " update rejected");
+        if (s.replay) {
+            std::string body;
+            if (!replay_.empty()) {
+                body = replay_[n % replay_.size()];
+            } else {
+                std::ostringstream b;
+                b << "{\"mode\":\"heat\",\"colour\":" << n % 100 << ",\"segments\":[";
+                for (int i = 0; i < g_cfg.segments; i++) b << (i ? "," : "") << (int)(50 + 50 * sinf(n * 0.2f + i));
+                b << "]}";
+                body = b.str();
+            }
+            if (!post(body)) rejected_++;
+        }
+        if (k == BENCH_WARMUP_FRAMES) {
+            frames0_ = g_frameStats.frames();
+            for (int st = 0; st < STAGE_COUNT; st++) stage0_[st] = g_frameStats.stage_us_total(st);
+            t0_ = std::chrono::steady_clock::now();
+        }
+        return true;
+    }
+
+    // After the capture writer has stopped: the golden comparison table
+    void report_golden() {
+        if (rejected_) log_ts("BENCH: " + std::to_string(rejected_) + " replayed update(s) rejected");
+        if (!golden_) return;
+        printf("\n%-10s %8s %8s %8s %8s\n", "scenario", "frames", "mean_err", "max_err", "psnr_db");
+        for (int sc = 0; sc < BENCH_SCENARIO_COUNT; sc++) {
+            const ErrorStats &e = errors_[sc];
+            const double samples = (double)e.frames * W * H * 3;
+            const double mse = samples ? e.sumSq / samples : 0.0;
+            printf("%-10s %8llu %8.3f %8d %8.2f\n", BENCH_SCENARIOS[sc].name, (unsigned long long)e.frames,
+                   samples ? e.sumAbs / samples : 0.0, e.maxAbs, mse > 0 ? 10.0 * log10(255.0 * 255.0 / mse) : 99.99);
+        }
+        fflush(stdout);
+        fclose(golden_);
+        golden_ = nullptr;
+    }
+
+private:
+    struct ErrorStats {
+        uint64_t frames = 0;
+        double sumAbs = 0, sumSq = 0;
+        int maxAbs = 0;
+    };
+
+    static bool post(const std::string &body) {
+        UpdateFields f;
+        return parse_update_json(body.data(), body.size(), f) && commit_update(f, nullptr);
+    }
+
+    // Scenario whose measured window contains frame n, or -1
+    static int measured_scenario(uint32_t n) {
+        const uint32_t per = BENCH_WARMUP_FRAMES + g_cfg.benchFrames;
+        return (n % per >= (uint32_t)BENCH_WARMUP_FRAMES && n / per < (uint32_t)BENCH_SCENARIO_COUNT) ? (int)(n / per) : -1;
+    }
+
+    void report(int sc) {
+        const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0_).count();
+        const uint64_t frames = g_frameStats.frames() - frames0_;
+
+        // Work quantiles over this scenario's frames still in the ring
+        std::vector<FrameSample> win = g_frameStats.snapshot();
+        std::vector<uint32_t> busy;
+        for (size_t k = win.size() - std::min<size_t>(win.size(), frames); k < win.size(); k++) busy.push_back(win[k].busy_us);
+
+        printf("%-10s %8.1f %8.3f %8.3f", BENCH_SCENARIOS[sc].name, frames / sec, quantile_us(busy, 0.5) / 1000.0, quantile_us(busy, 0.99) / 1000.0);
+        for (int st = 0; st < STAGE_SLEEP; st++)
+            printf(" %8.3f", frames ? (g_frameStats.stage_us_total(st) - stage0_[st]) / 1000.0 / frames : 0.0);
+        printf("\n");
+        fflush(stdout);
+    }
+
+    // Capture writer thread: both files hold frames in ascending seq order
+    void compare(const unsigned char *px, uint32_t seq) {
+        const int sc = measured_scenario(seq);
+        if (sc < 0) return;
+        CaptureFrameHeader fh;
+        while (!goldenDone_ && (!goldenValid_ || goldenSeq_ < seq)) {
+            goldenValid_ = fread(&fh, sizeof(fh), 1, golden_) == 1
+                        && fread(goldenPixels_.data(), 1, goldenPixels_.size(), golden_) == goldenPixels_.size();
+            goldenDone_ = !goldenValid_;
+            goldenSeq_ = fh.seq;
+        }
+        if (!goldenValid_ || goldenSeq_ != seq) return;   // dropped in either run
+
+        ErrorStats &e = errors_[sc];
+        const int bpp = g_capture.bpp(), gbpp = goldenBpp_;
+        for (int i = 0; i < W * H; i++) {
+            for (int ch = 0; ch < 3; ch++) {
+                const int d = abs((int)px[i * bpp + ch] - (int)goldenPixels_[i * gbpp + ch]);
+                e.sumAbs += d;
+                e.sumSq += d * d;
+                e.maxAbs = std::max(e.maxAbs, d);
+            }
+        }
+        e.frames++;
+    }
+
+    std::vector<std::string> replay_;
+    int rejected_ = 0;
+    uint64_t frames0_ = 0, stage0_[STAGE_COUNT] = {};
+    std::chrono::steady_clock::time_point t0_;
+
+    FILE *golden_ = nullptr;
+    int goldenBpp_ = 4;
+    std::vector<unsigned char> goldenPixels_;
+    uint32_t goldenSeq_ = 0;
+    bool goldenValid_ = false, goldenDone_ = false;
+    ErrorStats errors_[BENCH_SCENARIO_COUNT];
+};
+#endif
+
+// Every frame on its way to the canvas: the capture file and the preview stream
+static void tap_frame(const unsigned char *pixels, uint32_t seq, int bpp) {
+    g_capture.offer(pixels, seq);
+    g_preview.offer(pixels, bpp);
+}
+
+// =======================================================
+// PRIVILEGE DROP
+// =======================================================
+/**
+ * The matrix library drops root to daemon:daemon inside
+ * CreateMatrixFromFlags(). That now runs while the shaders compile and
+ * shader-cache is written, with the service threads already up, so its drop
+ * is disabled and the same flags are handled here instead: the process drops
+ * once the renderer and the matrix are both initialized. --led-daemon is
+ * removed as well, since a fork after the service threads started would
+ * leave the child without them.
+ */
+struct PrivilegeDrop {
+    bool enabled = true;                // --led-no-drop-privs turns it off
+    std::string user = "daemon";        // --led-drop-priv-user=
+    std::string group = "daemon";       // --led-drop-priv-group=
+};
+
+// Takes the privilege and daemon flags out of the matrix arguments (args[0] is the program)
+static void take_privilege_flags(std::vector<std::string> &args, PrivilegeDrop &drop) {
+    static const std::string USER_FLAG = "--led-drop-priv-user=", GROUP_FLAG = "--led-drop-priv-group=";
+    for (size_t i = 1; i < args.size(); ) {
+        const std::string &a = args[i];
+        if (a == "--led-no-drop-privs") drop.enabled = false;
+        else if (a.compare(0, USER_FLAG.size(), USER_FLAG) == 0) drop.user = a.substr(USER_FLAG.size());
+        else if (a.compare(0, GROUP_FLAG.size(), GROUP_FLAG) == 0) drop.group = a.substr(GROUP_FLAG.size());
+        else if (a == "--led-daemon") log_ts("INIT: --led-daemon is not supported (the API starts before the matrix), running in the foreground");
+        else { i++; continue; }
+        args.erase(args.begin() + i);
+    }
+}
+
+static bool drop_privileges(const PrivilegeDrop &drop) {
+    if (!drop.enabled || geteuid() != 0) return true;
+    const passwd *pw = getpwnam(drop.user.c_str());
+    const group *gr = getgrnam(drop.group.c_str());
+    if (!pw || !gr) { log_ts("INIT: Cannot drop privileges, no user " + drop.user + " or group " + drop.group); return false; }
+    const gid_t gid = gr->gr_gid;
+    const uid_t uid = pw->pw_uid;
+    if (setgroups(1, &gid) != 0 || setresgid(gid, gid, gid) != 0 || setresuid(uid, uid, uid) != 0) {
+        log_ts("INIT: Cannot drop privileges to " + drop.user + ":" + drop.group + ": " + strerror(errno));
+        return false;
+    }
+    log_ts("INIT: Running as " + drop.user + ":" + drop.group);
+    return true;
+}
+
+// =======================================================
+// MAIN LOOP
+// =======================================================
+int main(int argc, char *argv[]) {
+    log_ts("INIT: Starting Matrix Controller");
+
+    std::vector<std::string> matrixArgs;
+    if (!load_config(argc, argv, g_cfg, g_liveConfig, matrixArgs)) return EXIT_FAILURE;
+    g_log.configure(g_cfg.logFormat == "json", BENCHMARK ? 0 : g_cfg.logRate);
+    PrivilegeDrop privDrop;
+    take_privilege_flags(matrixArgs, privDrop);
+    if (!g_cfg.heatPalette.empty()) parse_heat_palette(g_cfg.heatPalette, g_heatPalette);
+    PANEL_W = H = g_cfg.panelSize;
+    W = NUM_PANELS * PANEL_W;
+    g_liveConfigBuf.back() = g_liveConfig;
+    g_liveConfigBuf.publish();
+
+    // Before any thread exists, so every thread we (or the GL driver) start inherits the mask
+    int cores;
+    if (avoid_core(g_cfg.refreshCore, cores))
+        log_ts("INIT: Threads kept off core " + std::to_string(g_cfg.refreshCore) + " (matrix refresh)");
+    else if (g_cfg.refreshCore >= 0)
+        log_ts("INIT: Cannot keep threads off core " + std::to_string(g_cfg.refreshCore) + ", running unpinned");
+    g_log.start();
+
+    // Services first: updates are accepted and buffered into the target state while
+    // the renderer and the matrix initialize (GET /health reports the phase)
+    signal(SIGINT, InterruptHandler); signal(SIGTERM, InterruptHandler);
+    std::thread apiThread, udpThread, streamThread, syncThread, shaderThread, thermalThread;
+    const bool syncLeader = !BENCHMARK && g_cfg.sync == "leader";
+    const bool syncFollower = !BENCHMARK && g_cfg.sync == "follower";
+    if (syncLeader) syncThread = std::thread(startSyncLeader);
+    if (syncFollower) syncThread = std::thread(startSyncFollower);
+    if (!BENCHMARK) apiThread = std::thread(startRestApi);
+    if (!BENCHMARK && g_cfg.udpPort != 0) udpThread = std::thread(startUdpApi);
+    if (!BENCHMARK && g_cfg.streamPort != 0) {
+        if (!g_preview.init(g_cfg.previewFps)) log_ts("STREAM: pipe() failed, preview disabled: " + std::string(strerror(errno)));
+        streamThread = std::thread(startStreamServer);
+    }
+    auto stop_services = [&] {
+        interrupt_received = true;
+        if(g_server) g_server->stop();
+        if (apiThread.joinable()) apiThread.join();
+        if (udpThread.joinable()) udpThread.join();
+        if (streamThread.joinable()) streamThread.join();
+        if (syncThread.joinable()) syncThread.join();
+        if (shaderThread.joinable()) shaderThread.join();
+        if (thermalThread.joinable()) thermalThread.join();
+    };
+    g_startPhase = PHASE_RENDERER;
+    const auto rendererStart = std::chrono::steady_clock::now();
+
+    // Renderer: GLES2 on an EGL pbuffer, or the CPU renderer (renderer=cpu, or auto without EGL)
+    bool gpu = g_cfg.renderer != "cpu" && init_egl();
+
+    // Matrix, created on its own thread while the shaders compile
+    //rgb_matrix::RGBMatrix::Options opt; opt.rows = 64; opt.cols = 192; opt.hardware_mapping = "adafruit-hat-pwm"; opt.panel_type = "FM6126A";
+    //rgb_matrix::RuntimeOptions rOpt; rOpt.gpio_slowdown = 2;
+    //RGBMatrix *matrix = rgb_matrix::CreateMatrixFromFlags(&argc, &argv, &opt, &rOpt);
+
+    //LED Matrix settings
+    rgb_matrix::RGBMatrix::Options defaults;
     defaults.hardware_mapping = "adafruit-hat-pwm";
     defaults.led_rgb_sequence = "RGB";
     defaults.pwm_bits = 11;
     //    defaults.pwm_lsb_nanoseconds = 50;
     defaults.panel_type = "FM6126A";
-    defaults.rows = 64;
-    defaults.cols = 192;
+    defaults.rows = H;
+    defaults.cols = W;
     //    defaults.chain_length = 1;
     //    defaults.parallel = 1;
     //  defaults.brightness = 60;
 
     rgb_matrix::RuntimeOptions runtime;
-    //    runtime.drop_privileges = 0;
+    runtime.daemon = -1;                // see PrivilegeDrop
+    runtime.drop_privileges = -1;
     runtime.gpio_slowdown = 2;
 
-    // Matrix
-    RGBMatrix *matrix = rgb_matrix::CreateMatrixFromFlags(&argc, &argv, &defaults, &runtime);
-    if (matrix == NULL)
+    // Config file led-* keys first, so the command line overrides them
+    std::vector<char *> mArgv;
+    for (std::string &a : matrixArgs) mArgv.push_back(&a[0]);
+    mArgv.push_back(nullptr);
+    int mArgc = (int)matrixArgs.size();
+    char **mArgvp = mArgv.data();
+    RGBMatrix *matrix = NULL;
+    std::thread matrixThread([&] {
+        const auto matrixStart = std::chrono::steady_clock::now();
+        matrix = rgb_matrix::CreateMatrixFromFlags(&mArgc, &mArgvp, &defaults, &runtime);
+        g_matrixMs = ms_since(matrixStart);
+    });
+    ShaderProgram programs[PLASMA_VARIANTS * NUM_GEOMETRIES * 2];
+    ShaderProgram bgPrograms[PLASMA_VARIANTS];
+    ShaderProgram userProgram;          // POST /shader or shader=PATH, replaces programs[] while set
+    if (gpu) g_programCache.init(g_cfg.shaderCache);
+    if (gpu && !build_programs(g_cfg.bgScale > 1, programs, bgPrograms)) gpu = false;
+    if (!gpu && g_cfg.renderer == "gpu") { matrixThread.join(); stop_services(); return EXIT_FAILURE; }
+    const bool bgTexture = gpu && g_cfg.bgScale > 1;
+    GLuint currentProg = programs[0].prog;
+    if (gpu) glUseProgram(currentProg);
+
+    // Quad strips (one per cube face, optionally pre-oriented for the matrix)
+    std::vector<GLfloat> verts, coords;
+    build_strip_geometry(GPU_REMAP, verts, coords);
+    const GLsizei vertCount = (GLsizei)(verts.size() / 3);
+    WorkerPool pool((g_cfg.renderThreads ? g_cfg.renderThreads : cores) - 1);
+    std::unique_ptr<CpuRenderer> cpu;
+    if (gpu) {
+        GLuint vbo[2]; glGenBuffers(2, vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo[0]); glBufferData(GL_ARRAY_BUFFER, verts.size() * sizeof(GLfloat), verts.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(ATTR_POS, 3, GL_FLOAT, GL_FALSE, 0, 0); glEnableVertexAttribArray(ATTR_POS);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo[1]); glBufferData(GL_ARRAY_BUFFER, coords.size() * sizeof(GLfloat), coords.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(ATTR_COORD, 2, GL_FLOAT, GL_FALSE, 0, 0); glEnableVertexAttribArray(ATTR_COORD);
+    } else {
+        // Same strips, rasterized once on the CPU
+        cpu.reset(new CpuRenderer(pool));
+        cpu->init(verts, coords);
+        log_ts(std::string("RENDER: CPU renderer, ") + std::to_string(pool.threads()) + " thread(s)"
+#ifdef LEDCUBE_NEON
+               + ", NEON"
+#endif
+               + (g_cfg.bgScale > 1 ? ", bg-scale ignored" : ""));
+    }
+    g_rendererMs = ms_since(rendererStart);
+
+    g_startPhase = PHASE_MATRIX;
+    matrixThread.join();
+    // Shaders are compiled and shader-cache written, so root is no longer needed
+    if (matrix == NULL || (!BENCHMARK && !drop_privileges(privDrop))) {
+        stop_services();
         return EXIT_FAILURE;
+    }
+    g_startPhase = PHASE_SETUP;
+    if (matrix->width() != W || matrix->height() != H)
+        log_ts("INIT: Matrix is " + std::to_string(matrix->width()) + "x" + std::to_string(matrix->height())
+               + " but panel-size " + std::to_string(g_cfg.panelSize) + " renders " + std::to_string(W) + "x" + std::to_string(H));
 
     FrameCanvas *canvas = matrix->CreateFrameCanvas();
+    g_baseBrightness = matrix->brightness();
+    g_basePwmBits = matrix->pwmbits();
 
-    signal(SIGINT, InterruptHandler); signal(SIGTERM, InterruptHandler);
-    std::thread apiThread(startRestApi);
-    unsigned char *buffer = (unsigned char *)malloc(W * H * 3);
+    // Output tiles need every panel in its own columns of the canvas (see g_blitPool)
+    bool mapped = matrix->width() != W || matrix->height() != H;
+    for (const std::string &a : matrixArgs) mapped |= a.compare(0, 18, "--led-pixel-mapper") == 0;
+    if (pool.threads() > 1 && !mapped) g_blitPool = &pool;
+    log_ts("RENDER: " + std::to_string(pool.threads()) + " frame thread(s) on " + std::to_string(cores) + " core(s)"
+           + (g_blitPool ? ", output in " + std::to_string(NUM_PANELS) + " column tiles" : ""));
+
+    if (!BENCHMARK && gpu) shaderThread = std::thread(startShaderReload);
+    else if (!g_cfg.shader.empty()) log_ts("GL: shader needs the GPU renderer, ignored");
+    if (!BENCHMARK && g_cfg.thermal) thermalThread = std::thread(startThermalMonitor);
+    build_remap_lut(GPU_REMAP);
+    build_tone_lut(g_cfg.gamma, g_cfg.whiteBalance);
+    if (!tone_identity)
+        log_ts("RENDER: Output tone curve gamma " + fmt_float(g_cfg.gamma, 2) + ", gain " + fmt_float(g_cfg.whiteBalance[0], 2)
+               + "/" + fmt_float(g_cfg.whiteBalance[1], 2) + "/" + fmt_float(g_cfg.whiteBalance[2], 2));
+
+    // Render targets: RGBA mode always renders into FBOs (pipelined mode ping-pongs two)
+    bool pipelined = PIPELINED_RENDER;
+    bool useFbo = gpu && (pipelined || READBACK_RGBA);
+    GLenum readFormat = (READBACK_RGBA || !gpu) ? GL_RGBA : GL_RGB;   // the CPU renderer writes RGBA
+    GLuint fbo[2] = {0, 0}, fboTex[2] = {0, 0};
+    if (useFbo && !(create_fbo(fbo[0], fboTex[0], readFormat) && (!pipelined || create_fbo(fbo[1], fboTex[1], readFormat)))) {
+        log_ts("RENDER: FBO setup failed, falling back to serial pbuffer rendering");
+        pipelined = useFbo = false;
+        readFormat = GL_RGB;
+    }
+    const int bpp = (readFormat == GL_RGBA) ? 4 : 3;
+
+    // Low-resolution background target, bilinearly sampled by the composite programs on unit 0
+    GLuint bgFbo = 0, bgTex = 0;
+    int bgW = W / g_cfg.bgScale, bgH = H / g_cfg.bgScale;
+    if (bgTexture) {
+        if (!create_fbo(bgFbo, bgTex, GL_RGBA, bgW, bgH, GL_LINEAR)) { stop_services(); return 1; }
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, bgTex);
+        for (const ShaderProgram &p : programs) {
+            if (!p.prog) continue;
+            glUseProgram(p.prog);
+            glUniform1i(p.u_bgTex, 0);
+            glUniform1f(p.u_bgScale, (float)g_cfg.bgScale);
+        }
+        glUseProgram(currentProg);
+        log_ts("RENDER: Background at " + std::to_string(bgW) + "x" + std::to_string(bgH)
+               + ", refreshed every " + std::to_string(g_cfg.bgInterval) + " frame(s)");
+    }
+    int bgFrame = 0;
+
+    // Segment levels as a (segments+1) x 1 luminance texture on unit 1. Linear filtering
+    // does the neighbour blend in segmentAt(); the extra texel repeats segment 0 so the
+    // last segment wraps into the first.
+    GLuint segTex = 0;
+    std::vector<uint8_t> segTexels(g_cfg.segments + 1, 0), segUploaded(g_cfg.segments + 1, 0);
+    if (gpu) {
+        glActiveTexture(GL_TEXTURE1);
+        glGenTextures(1, &segTex);
+        glBindTexture(GL_TEXTURE_2D, segTex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, g_cfg.segments + 1, 1, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, segTexels.data());
+        glActiveTexture(GL_TEXTURE0);
+        for (const ShaderProgram &p : programs) {
+            if (!p.prog) continue;
+            glUseProgram(p.prog);
+            glUniform1i(p.u_segTex, 1);
+        }
+        glUseProgram(currentProg);
+    }
+
+    if (useFbo && !pipelined) glBindFramebuffer(GL_FRAMEBUFFER, fbo[0]);
+    unsigned char *buffer = (unsigned char *)malloc(W * H * bpp);
+    FramePipeline pipeline(W * H * bpp);
+    std::thread copyThread;
+    if (pipelined) {
+        copyThread = std::thread([&] {
+            while (FrameSlot *slot = pipeline.acquire_ready()) {
+                auto c0 = std::chrono::steady_clock::now();
+                if (slot->blank) canvas->Clear();
+                else {
+                    tap_frame(slot->pixels.data(), slot->seq, bpp);
+                    apply_thermal_output(canvas);
+                    blit_to_canvas(slot->pixels.data(), canvas, bpp);
+                }
+                pipeline.release(slot);
+                auto c1 = std::chrono::steady_clock::now();
+                canvas = matrix->SwapOnVSync(canvas);
+                auto c2 = std::chrono::steady_clock::now();
+                g_pipeCopyUs.store(std::chrono::duration_cast<std::chrono::microseconds>(c1 - c0).count(), std::memory_order_relaxed);
+                g_pipeSwapUs.store(std::chrono::duration_cast<std::chrono::microseconds>(c2 - c1).count(), std::memory_order_relaxed);
+            }
+        });
+        log_ts(gpu ? "RENDER: Pipelined readback enabled (2 FBOs, copy thread)" : "RENDER: Pipelined output enabled (copy thread)");
+    }
+    // Frame capture (and the benchmark's golden comparison, which inspects captured frames)
+#ifdef LEDCUBE_BENCHMARK
+    BenchRunner bench;
+    if (!bench.init()) {
+        pipeline.shutdown();
+        if (copyThread.joinable()) copyThread.join();
+        stop_services();
+        return EXIT_FAILURE;
+    }
+    const bool inspect = bench.golden();
+#else
+    const bool inspect = false;
+#endif
+    if ((!g_cfg.capture.empty() || inspect)
+        && !g_capture.open(g_cfg.capture, W, H, bpp, lut_identity ? FrameCapture::FLAG_MATRIX_ORDER : 0, g_cfg.captureFrames)) {
+        pipeline.shutdown();
+        if (copyThread.joinable()) copyThread.join();
+        stop_services();
+        return EXIT_FAILURE;
+    }
+    if (!g_cfg.capture.empty())
+        log_ts("CAPTURE: Recording " + std::string(bpp == 4 ? "RGBA" : "RGB") + " frames to " + g_cfg.capture);
+
+    g_renderPath = std::string(pipelined ? "pipelined_" : "serial_") + (!gpu ? "cpu_" : useFbo ? "fbo_" : "pbuffer_") + (bpp == 4 ? "rgba" : "rgb");
+    if (gpu) log_ts(std::string("RENDER: Reading back ") + (bpp == 4 ? "GL_RGBA" : "GL_RGB") + " from " + (useFbo ? "FBO" : "pbuffer"));
+
+    // Per-stage timing: lap() charges the time since the previous lap to a stage
+    FrameSample sample;
+    auto lapMark = std::chrono::steady_clock::now();
+    auto lap = [&](FrameStage st) {
+        auto now = std::chrono::steady_clock::now();
+        sample.us[st] += (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(now - lapMark).count();
+        lapMark = now;
+    };
+
+    // Periodic summary of the metrics ring in the log, every STATS_LOG_INTERVAL seconds
+    const int STATS_LOG_INTERVAL = 10;
+    auto statsLogStart = std::chrono::steady_clock::now();
+    auto timed_readback = [&](unsigned char *dst) {
+        glReadPixels(0, 0, W, H, readFormat, GL_UNSIGNED_BYTE, dst);
+        lap(STAGE_READBACK);
+    };
+    int curFbo = 0;
+    bool havePrevFrame = false;
+    uint32_t frameNo = 0, prevFrameNo = 0;   // loop iterations; prevFrameNo: frame drawn into the other FBO
+
+    // Static scene detection: the last frame is reused once the scene has been
+    // static for more frames than the pipeline holds (so the final frame is out)
+    const int STATIC_FLUSH_FRAMES = pipelined ? 2 : 1;
+    int staticFrames = 0;
+    VisualState live;   // interpolated state actually rendered
+    VisualState target;                 // the API target as of this frame
+    uint32_t seenGeneration = 0;
+    uint32_t seenTimeline = 0;
+    bool timelinePlaying = false;
+    float timelineStart = 0.0f;
+    VisualState timelineFrom;   // live state when the current timeline started
+    float lastUpdateTime = updateTime;
+    int lastGeometryMode = live.geometryMode;
+    bool lastBlanked = false;
+    uint32_t lastConfigGeneration = 0;
+    int lastThermalTier = g_thermalTier.load();
     auto last_time = std::chrono::steady_clock::now();
 
+    // Frame pacing; the governor may also coarsen the background in steps of 2x
+    int bgSteps = 0;
+    while (bgTexture && g_cfg.maxBgScale >= (g_cfg.bgScale << (bgSteps + 1))
+           && g_cfg.panelSize % (g_cfg.bgScale << (bgSteps + 1)) == 0) bgSteps++;
+    FrameGovernor governor(!BENCHMARK && g_cfg.governor != 0, bgSteps);
+    int bgStep = 0;
+    g_govBgScale = g_cfg.bgScale;
+
+    g_readyMs = ms_since(start_time);
+    g_startPhase = PHASE_RENDERING;
+    log_ts("INIT: Rendering after " + std::to_string(g_readyMs) + " ms (renderer " + std::to_string(g_rendererMs) + " ms, matrix "
+           + std::to_string(g_matrixMs) + " ms in parallel" + (g_apiUpMs >= 0 ? ", API up at " + std::to_string(g_apiUpMs) + " ms" : "") + ")");
     log_ts("RENDER: Entering main loop");
 
     /**
@@ -942,111 +5716,399 @@ int main(int argc, char *argv[]) {
      *      The image gradually fades to grayscale after a configurable delay.
      *
      *  - Long-term loss (blanking):
-     *      If no UDP update is received for BLANKINTERVAL seconds, the LED
+     *      If no UDP update is received for blank-interval seconds, the LED
      *      matrix is completely cleared (black).
      *
      * Disabling blanking:
-     *  - Set BLANKINTERVAL to 0 to disable long-term blanking entirely.
+     *  - Set blank-interval to 0 to disable long-term blanking entirely.
      *    In this mode, the display will remain visible (including grayscale
      *    fade) indefinitely, even without incoming data.
      */
 
-    // Cache uniform locations once (critical for performance on Raspberry Pi)
-    GLint u_time        = glGetUniformLocation(prog, "time");
-    GLint u_age         = glGetUniformLocation(prog, "age");
-    GLint u_colourLevel = glGetUniformLocation(prog, "colourLevel");
-    GLint u_segment     = glGetUniformLocation(prog, "segment");
-    GLint u_geom        = glGetUniformLocation(prog, "u_geom");
-    GLint u_bgColor     = glGetUniformLocation(prog, "u_bgColor");
-    GLint u_elColor     = glGetUniformLocation(prog, "u_elementColor");
-    GLint u_width       = glGetUniformLocation(prog, "u_width");
-    GLint u_percent     = glGetUniformLocation(prog, "u_percent");
 
     while (!interrupt_received) {
         auto frame_start = std::chrono::steady_clock::now();
-        float dt = compat::clamp(std::chrono::duration<float>(frame_start - last_time).count(), 0.0f, 0.1f);
+        sample = FrameSample();
+        lapMark = frame_start;
+        float dt = BENCHMARK ? BENCH_DT : compat::clamp(std::chrono::duration<float>(frame_start - last_time).count(), 0.0f, 0.1f);
         last_time = frame_start;
         t += dt;
+        if (syncFollower) {
+            // Phase-lock to the leader; a step moves the clock's anchors with it
+            bool stepped;
+            float corr = sync_correction(t, dt, frame_start, stepped);
+            t += corr;
+            if (stepped) { updateTime += corr; timelineStart += corr; }
+        } else if (syncLeader) {
+            SyncClock &clk = g_localClockBuf.back();
+            clk.clock = t;
+            clk.at = frame_start;
+            clk.seq = frameNo + 1;
+            g_localClockBuf.publish();
+        }
+        const uint32_t frame = frameNo++;
+#ifdef LEDCUBE_BENCHMARK
+        if (!bench.frame(frame)) break;
+#endif
 
-        // --- Smooth state interpolation (thread-safe) ------------------------
-        {
-            std::lock_guard<std::mutex> lk(state_mtx);
+        // Runtime-adjustable settings (POST /config), wait-free like the targets
+        const LiveConfig &lc = g_liveConfigBuf.read();
+        const float animStep = lc.animStep;
+        const int thermalTier = g_thermalTier.load(std::memory_order_relaxed);
+        const ThermalTier &thermal = THERMAL_TIERS[thermalTier];
+        governor.set_target(std::max(1, (int)lround(lc.targetFps * thermal.fpsScale)));
 
-            colourLevel += compat::clamp(tcolourLevel - colourLevel, -ANIMSTEP*dt, ANIMSTEP*dt);
+        // --- Smooth state interpolation (the API targets, merged since last frame) ----
+        take_staged_target(target);
+        if (target.generation != seenGeneration) {
+            seenGeneration = target.generation;
+            updateTime = t;
+        }
+
+        const Timeline &timeline = g_timelineBuf.read();
+        if (timeline.generation != seenTimeline) {
+            seenTimeline = timeline.generation;
+            timelinePlaying = timeline.count > 0;
+            timelineStart = t;
+            timelineFrom = live;
+        }
 
-            for(int i=0; i<SEGMENTS; i++)
-                segment[i] += compat::clamp(tsegment[i] - segment[i], -ANIMSTEP*dt, ANIMSTEP*dt);
+        bool settled = false;
+        if (timelinePlaying) {
+            // Keyframe playback drives the live state directly; it counts as live signal
+            timelinePlaying = sample_timeline(timeline, t - timelineStart, timelineFrom, live);
+            live.generation = target.generation;
+            updateTime = t;
+        } else {
+            live.colourLevel += compat::clamp(target.colourLevel - live.colourLevel, -animStep*dt, animStep*dt);
 
-            geometryMode = tgeometryMode;
-            modeStr = tmodeStr;
+            for(int i=0; i<g_cfg.segments; i++)
+                live.segment[i] += compat::clamp(target.segment[i] - live.segment[i], -animStep*dt, animStep*dt);
+
+            live.geometryMode = target.geometryMode;
+            memcpy(live.mode, target.mode, sizeof(live.mode));
 
             // width/percent interpolate
-            elementWidth += compat::clamp(telementWidth - elementWidth, -ANIMSTEP*dt, ANIMSTEP*dt);
-            percent += compat::clamp(tpercent - percent, -ANIMSTEP*dt, ANIMSTEP*dt);
+            live.elementWidth += compat::clamp(target.elementWidth - live.elementWidth, -animStep*dt, animStep*dt);
+            live.percent += compat::clamp(target.percent - live.percent, -animStep*dt, animStep*dt);
 
             // colors interpolate (fast, but still smooth)
             for (int k = 0; k < 3; k++) {
-                elementColorRGB[k] += compat::clamp(telementColorRGB[k] - elementColorRGB[k], -2.0f*dt, 2.0f*dt);
-                backgroundColorRGB[k] += compat::clamp(tbackgroundColorRGB[k] - backgroundColorRGB[k], -2.0f*dt, 2.0f*dt);
+                live.elementColorRGB[k] += compat::clamp(target.elementColorRGB[k] - live.elementColorRGB[k], -2.0f*dt, 2.0f*dt);
+                live.backgroundColorRGB[k] += compat::clamp(target.backgroundColorRGB[k] - live.backgroundColorRGB[k], -2.0f*dt, 2.0f*dt);
+            }
+            live.haveElementColor = target.haveElementColor;
+            live.haveBackgroundColor = target.haveBackgroundColor;
+            live.generation = target.generation;
+
+            // Element layers chase like the primary; new ones appear at their target
+            for (int i = 0; i < target.nlayers; i++) {
+                Layer &l = live.layer[i];
+                const Layer &goal = target.layer[i];
+                if (i >= live.nlayers) l = goal;
+                l.geometryMode = goal.geometryMode;
+                l.radius += compat::clamp(goal.radius - l.radius, -animStep*dt, animStep*dt);
+                l.width += compat::clamp(goal.width - l.width, -animStep*dt, animStep*dt);
+                l.percent += compat::clamp(goal.percent - l.percent, -animStep*dt, animStep*dt);
+                for (int k = 0; k < 3; k++)
+                    l.colorRGB[k] += compat::clamp(goal.colorRGB[k] - l.colorRGB[k], -2.0f*dt, 2.0f*dt);
+            }
+            live.nlayers = target.nlayers;
+
+            // All interpolants reached their targets (the clamp walk lands within float noise)
+            const float EPS = 1e-4f;
+            settled = fabsf(target.colourLevel - live.colourLevel) < EPS
+                   && fabsf(target.elementWidth - live.elementWidth) < EPS
+                   && fabsf(target.percent - live.percent) < EPS;
+            for (int i = 0; settled && i < g_cfg.segments; i++)
+                settled = fabsf(target.segment[i] - live.segment[i]) < EPS;
+            for (int k = 0; settled && k < 3; k++)
+                settled = fabsf(target.elementColorRGB[k] - live.elementColorRGB[k]) < EPS
+                       && fabsf(target.backgroundColorRGB[k] - live.backgroundColorRGB[k]) < EPS;
+            for (int i = 0; settled && i < live.nlayers; i++) {
+                const Layer &l = live.layer[i], &goal = target.layer[i];
+                settled = fabsf(goal.radius - l.radius) < EPS && fabsf(goal.width - l.width) < EPS
+                       && fabsf(goal.percent - l.percent) < EPS;
+                for (int k = 0; settled && k < 3; k++) settled = fabsf(goal.colorRGB[k] - l.colorRGB[k]) < EPS;
             }
-            haveElementColor = thaveElementColor;
-            haveBackgroundColor = thaveBackgroundColor;
         }
+        float frameUpdateTime = updateTime;
+        lap(STAGE_INTERP);
 
         // Time since last UDP update (seconds)
         float age = t - updateTime;
 
+        LiveStatus &published = g_liveBuf.back();
+        published.state = live;
+        published.age = age;
+        published.timeline = timelinePlaying;
+        g_liveBuf.publish();
+
         // Freeze animation time during signal loss to reduce flicker and load
-        float renderTime = (age < GRAY_START_TIME) ? t : updateTime;
+        float renderTime = (age < lc.grayStart) ? t : updateTime;
+
+        // A user shader compiled since the last frame replaces the built-in programs
+        const bool shaderSwapped = gpu && take_user_shader(userProgram);
+        if (shaderSwapped && userProgram.prog) {
+            glUseProgram(userProgram.prog);
+            glUniform1i(userProgram.u_bgTex, 0);
+            glUniform1f(userProgram.u_bgScale, (float)(g_cfg.bgScale << bgStep));
+            glUniform1i(userProgram.u_segTex, 1);
+        }
+        if (shaderSwapped) currentProg = userProgram.prog;
+
+        // --- Static scene detection -------------------------------------------
+        // Once time is frozen and the grayscale fade is complete (or the canvas
+        // is blanked), every frame is identical until something changes.
+        bool blanked = !(g_cfg.blankInterval == 0 || age < g_cfg.blankInterval);
+        bool sceneStatic = SKIP_STATIC_FRAMES && settled
+                        && (blanked || age >= lc.grayEnd)
+                        && frameUpdateTime == lastUpdateTime
+                        && lc.generation == lastConfigGeneration
+                        && live.geometryMode == lastGeometryMode
+                        && blanked == lastBlanked
+                        && thermalTier == lastThermalTier   // redraw both canvases at the new brightness/PWM depth
+                        && !shaderSwapped;
+        lastThermalTier = thermalTier;
+        lastUpdateTime = frameUpdateTime;
+        lastGeometryMode = live.geometryMode;
+        lastBlanked = blanked;
+        lastConfigGeneration = lc.generation;
+        if (!sceneStatic) {
+            if (staticFrames > STATIC_FLUSH_FRAMES) log_ts("RENDER: Scene changed, resuming rendering");
+            staticFrames = 0;
+        } else if (++staticFrames > STATIC_FLUSH_FRAMES) {
+            if (staticFrames == STATIC_FLUSH_FRAMES + 1)
+                log_ts("RENDER: Scene static, reusing last frame (idle at " + std::to_string(IDLE_FPS) + " fps)");
+            // The matrix keeps showing the last swapped canvas; no GL or copy work
+            g_frameStats.count_skipped();
+            governor.wait(IDLE_FPS);
+            continue;
+        }
+
+        // Segment levels are rendered from 8-bit texels (u_segTex on the GPU)
+        for (int i = 0; i < g_cfg.segments; i++)
+            segTexels[i] = (uint8_t)lrintf(compat::clamp(live.segment[i], 0.0f, 100.0f) * 2.55f);
+        segTexels[g_cfg.segments] = segTexels[0];
 
         // --- Rendering / blanking decision -----------------------------------
-        if (BLANKINTERVAL == 0 || age < BLANKINTERVAL) {
+        if (!blanked && !gpu) {
+            // CPU renderer: the same scene, written straight into a host frame
+            CpuFrame cf;
+            cf.time = renderTime; cf.age = age;
+            cf.grayStart = lc.grayStart; cf.grayEnd = lc.grayEnd;
+            cf.geom = live.geometryMode;
+            cf.width = live.elementWidth; cf.percent = live.percent;
+            memcpy(cf.bg, live.backgroundColorRGB, sizeof(cf.bg));
+            memcpy(cf.el, live.elementColorRGB, sizeof(cf.el));
+            cf.layer = live.layer; cf.nlayers = live.nlayers;
+            cf.segTexels = segTexels.data();
+            cf.plasmaIter = thermal.cheapPlasma ? PLASMA_ITER_CHEAP : PLASMA_ITER_FULL;
+            lap(STAGE_UNIFORMS);
+            if (pipelined) {
+                FrameSlot *slot = pipeline.acquire_free();
+                if (!slot) break;
+                lap(STAGE_QUEUE);
+                cpu->render(cf, slot->pixels.data());
+                lap(STAGE_DRAW);
+                slot->blank = false;
+                slot->seq = frame;
+                pipeline.submit(slot);
+            } else {
+                cpu->render(cf, buffer);
+                lap(STAGE_DRAW);
+                tap_frame(buffer, frame, bpp);
+                apply_thermal_output(canvas);
+                blit_to_canvas(buffer, canvas, bpp);
+                lap(STAGE_COPY);
+            }
+        } else if (!blanked) {
             // Normal rendering path (includes grayscale fade in shader)
-            glUniform1f(u_time,        renderTime);
-            glUniform1f(u_age,         age);
-            glUniform1f(u_colourLevel, colourLevel);
-            glUniform1fv(u_segment,    SEGMENTS, segment);
-            glUniform1i(u_geom,        geometryMode);
+            // The cheap plasma lives in the composite programs, or with bgTexture in the background pass
+            const int plasma = thermal.cheapPlasma ? 1 : 0;
+            const ShaderProgram *block = programs + (bgTexture ? 0 : plasma * NUM_GEOMETRIES * 2);
+            const ShaderProgram &sp = userProgram.prog ? userProgram
+                : SPECIALIZE_SHADERS ? block[live.geometryMode * 2 + (live.percent >= FULL_ARC_PERCENT ? 1 : 0)]
+                : block[0];
+            if (sp.prog != currentProg) { glUseProgram(sp.prog); currentProg = sp.prog; }
+
+            glUniform1f(sp.u_time,        renderTime);
+            glUniform1f(sp.u_age,         age);
+            glUniform1f(sp.u_colourLevel, live.colourLevel);
+            glUniform1i(sp.u_geom,        live.geometryMode);
 
             // Always send colors/width/percent (even in heat mode, because heat mode uses them too)
-            glUniform3f(u_bgColor, backgroundColorRGB[0], backgroundColorRGB[1], backgroundColorRGB[2]);
-            glUniform3f(u_elColor, elementColorRGB[0], elementColorRGB[1], elementColorRGB[2]);
-            glUniform1f(u_width,   elementWidth);
-            glUniform1f(u_percent, percent);
-
-            glDrawArrays(GL_TRIANGLE_STRIP, 0, 12);
-            glReadPixels(0, 0, W, H, GL_RGB, GL_UNSIGNED_BYTE, buffer);
-
-            // OpenGL (0,0) is bottom-left → LED matrix expects top-left
-            for (int y = 0; y < H; y++) {
-                int gl_y = (H - 1) - y;
-                for (int x = 0; x < W; x++) {
-                    int mx, my; map_xy(x, y, mx, my);
-                    int idx = gl_y*W*3 + x*3;
-                    canvas->SetPixel(mx, my, buffer[idx], buffer[idx + 1], buffer[idx + 2]);
+            glUniform3f(sp.u_bgColor, live.backgroundColorRGB[0], live.backgroundColorRGB[1], live.backgroundColorRGB[2]);
+            glUniform3f(sp.u_elColor, live.elementColorRGB[0], live.elementColorRGB[1], live.elementColorRGB[2]);
+            glUniform1f(sp.u_width,   live.elementWidth);
+            glUniform1f(sp.u_percent, live.percent);
+            glUniform1f(sp.u_grayStart, lc.grayStart);
+            glUniform1f(sp.u_grayEnd,   lc.grayEnd);
+            glUniform1i(sp.u_layerCount, live.nlayers);
+            if (live.nlayers > 0) {
+                GLfloat shape[MAX_LAYERS][4], color[MAX_LAYERS][3];
+                for (int i = 0; i < live.nlayers; i++) {
+                    const Layer &l = live.layer[i];
+                    shape[i][0] = (GLfloat)l.geometryMode; shape[i][1] = l.radius;
+                    shape[i][2] = l.width; shape[i][3] = l.percent;
+                    memcpy(color[i], l.colorRGB, sizeof(color[i]));
+                }
+                glUniform4fv(sp.u_layerShape, live.nlayers, shape[0]);
+                glUniform3fv(sp.u_layerColor, live.nlayers, color[0]);
+            }
+
+            // Upload the segment texels only when they change
+            if (segTexels != segUploaded) {
+                glActiveTexture(GL_TEXTURE1);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, g_cfg.segments + 1, 1, GL_LUMINANCE, GL_UNSIGNED_BYTE, segTexels.data());
+                glActiveTexture(GL_TEXTURE0);
+                segUploaded = segTexels;
+            }
+            lap(STAGE_UNIFORMS);
+
+            // Background pass: refresh the low-resolution plasma every bgInterval frames
+            GLuint target = pipelined ? fbo[curFbo] : useFbo ? fbo[0] : 0;
+            if (bgTexture && bgFrame++ % (g_cfg.bgInterval * thermal.bgIntervalMul) == 0) {
+                glBindFramebuffer(GL_FRAMEBUFFER, bgFbo);
+                glViewport(0, 0, bgW, bgH);
+                const ShaderProgram &bp = bgPrograms[plasma];
+                glUseProgram(bp.prog);
+                glUniform1f(bp.u_time, renderTime);
+                glUniform3f(bp.u_bgColor, live.backgroundColorRGB[0], live.backgroundColorRGB[1], live.backgroundColorRGB[2]);
+                glDrawArrays(GL_TRIANGLE_STRIP, 0, vertCount);
+                glViewport(0, 0, W, H);
+                glUseProgram(currentProg);
+                glBindFramebuffer(GL_FRAMEBUFFER, target);
+            }
+
+            if (pipelined) {
+                // Draw frame N into one FBO, then read frame N-1 from the other
+                // while the GPU is still busy with N
+                glBindFramebuffer(GL_FRAMEBUFFER, target);
+                glDrawArrays(GL_TRIANGLE_STRIP, 0, vertCount);
+                lap(STAGE_DRAW);
+                if (havePrevFrame) {
+                    FrameSlot *slot = pipeline.acquire_free();
+                    if (!slot) break;
+                    lap(STAGE_QUEUE);
+                    glBindFramebuffer(GL_FRAMEBUFFER, fbo[curFbo ^ 1]);
+                    timed_readback(slot->pixels.data());
+                    slot->blank = false;
+                    slot->seq = prevFrameNo;
+                    pipeline.submit(slot);
                 }
+                curFbo ^= 1;
+                havePrevFrame = true;
+                prevFrameNo = frame;
+            } else {
+                glDrawArrays(GL_TRIANGLE_STRIP, 0, vertCount);
+                lap(STAGE_DRAW);
+                timed_readback(buffer);
+
+                // Orientation (GL flip, panel mirror, panel flags) is baked into the LUT or the geometry
+                tap_frame(buffer, frame, bpp);
+                apply_thermal_output(canvas);
+                blit_to_canvas(buffer, canvas, bpp);
+                lap(STAGE_COPY);
             }
+        } else if (pipelined) {
+            // Long-term signal loss, see below; the copy thread clears the canvas
+            FrameSlot *slot = pipeline.acquire_free();
+            if (!slot) break;
+            lap(STAGE_QUEUE);
+            slot->blank = true;
+            pipeline.submit(slot);
+            havePrevFrame = false;
         } else {
             /**
              * Long-term signal loss:
-             * The display is blanked completely after BLANKINTERVAL seconds
+             * The display is blanked completely after blank-interval seconds
              * of inactivity to reduce visual noise and CPU/GPU load.
              *
-             * Blanking can be disabled by setting BLANKINTERVAL to 0.
+             * Blanking can be disabled by setting blank-interval to 0.
              */
             canvas->Clear();
+            lap(STAGE_COPY);
         }
 
-        canvas = matrix->SwapOnVSync(canvas);
+        if (!pipelined) {
+            canvas = matrix->SwapOnVSync(canvas);
+            lap(STAGE_SWAP);
+        } else {
+            sample.us[STAGE_COPY] = g_pipeCopyUs.load(std::memory_order_relaxed);
+            sample.us[STAGE_SWAP] = g_pipeSwapUs.load(std::memory_order_relaxed);
+        }
 
-        // --- Frame rate limiting ---------------------------------------------
+        // --- Frame pacing ----------------------------------------------------
+        // Busy time is measured on the render thread; work excludes waiting on the display
         int el = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - frame_start).count();
-        if (el < 1000000/TARGET_FPS) usleep(1000000/TARGET_FPS - el);
+        uint32_t waited = pipelined ? sample.us[STAGE_QUEUE] : sample.us[STAGE_SWAP];
+        int prevFps = governor.fps();
+        if (governor.observe(el > (int)waited ? el - waited : 0, std::chrono::duration<double>(frame_start.time_since_epoch()).count())) {
+            log_ts("GOVERNOR: " + std::to_string(prevFps) + " -> " + std::to_string(governor.fps()) + " fps"
+                   + (bgTexture ? ", background 1/" + std::to_string(g_cfg.bgScale << governor.bg_step()) : std::string()));
+        }
+        if (governor.bg_step() != bgStep) {
+            // Re-specify the background texture at the new size; the FBO attachment stays valid
+            bgStep = governor.bg_step();
+            const int scale = g_cfg.bgScale << bgStep;
+            bgW = W / scale; bgH = H / scale;
+            glBindTexture(GL_TEXTURE_2D, bgTex);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bgW, bgH, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            for (const ShaderProgram &p : programs) {
+                if (!p.prog) continue;
+                glUseProgram(p.prog);
+                glUniform1f(p.u_bgScale, (float)scale);
+            }
+            if (userProgram.prog) {
+                glUseProgram(userProgram.prog);
+                glUniform1f(userProgram.u_bgScale, (float)scale);
+            }
+            glUseProgram(currentProg);
+            bgFrame = 0;
+            g_govBgScale = scale;
+        }
+        g_govFps = governor.fps();
+        bool onTime = BENCHMARK || governor.wait(governor.fps());   // the benchmark runs uncapped
+        lap(STAGE_SLEEP);
+
+        // A frame is dropped when it ends after its deadline
+        sample.busy_us = (uint32_t)el;
+        g_frameStats.push(sample, !onTime);
+
+        if (frame_start - statsLogStart >= std::chrono::seconds(STATS_LOG_INTERVAL)) {
+            std::vector<FrameSample> win = g_frameStats.snapshot();
+            std::vector<uint32_t> busy, rb;
+            for (const FrameSample &f : win) { busy.push_back(f.busy_us); rb.push_back(f.us[STAGE_READBACK]); }
+            log_ts(std::string("STATS: frame p50 ") + fmt_float(quantile_us(busy, 0.5) / 1000.0f) + " ms"
+                   + ", p99 " + fmt_float(quantile_us(busy, 0.99) / 1000.0f) + " ms"
+                   + ", readback " + (bpp == 4 ? "GL_RGBA" : "GL_RGB")
+                   + " p50 " + fmt_float(quantile_us(rb, 0.5) / 1000.0f) + " ms"
+                   + ", dropped " + std::to_string(g_frameStats.dropped()) + "/" + std::to_string(g_frameStats.frames())
+                   + ", " + std::to_string(governor.fps()) + " fps");
+            statsLogStart = frame_start;
+        }
     }
 
     log_ts("EXIT: Shutting down");
-    if(g_server) g_server->stop();
-    apiThread.join();
+    g_startPhase = PHASE_STOPPING;
+    // The pipelined path reads each frame back one iteration late, so the last one is still in its FBO
+    if (pipelined && havePrevFrame) {
+        if (FrameSlot *slot = pipeline.acquire_free()) {
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo[curFbo ^ 1]);
+            glReadPixels(0, 0, W, H, readFormat, GL_UNSIGNED_BYTE, slot->pixels.data());
+            slot->blank = false;
+            slot->seq = prevFrameNo;
+            pipeline.submit(slot);
+        }
+    }
+    pipeline.shutdown();
+    if (copyThread.joinable()) copyThread.join();
+    stop_services();
+    g_capture.close();
+#ifdef LEDCUBE_BENCHMARK
+    bench.report_golden();
+#endif
     free(buffer);
     return 0;
 }